@@ -1,19 +1,31 @@
-#include "HardwareSerial.h"
+#include <util/atomic.h>
 #include "fan_control.h"
 #include "low_power.h"
 #include "wdt_time.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "led_pattern.h"
+#include "warm_restart.h"
+#include "fan_profile.h"
 
 //
 // ANALOG OUT
 //
 const pwm_duty_t FAN_OUT_FAN_OFF = ANALOG_OUT_MIN;
 
-// Continuous mode:
-const pwm_duty_t FAN_OUT_CONTINUOUS_LOW_DUTY_VALUE = (uint32_t) ANALOG_OUT_MAX * FAN_CONTINUOUS_LOW_VOLTAGE /  FAN_MAX_VOLTAGE;
-const pwm_duty_t FAN_OUT_CONTINUOUS_MEDIUM_DUTY_VALUE = (uint32_t) ANALOG_OUT_MAX * FAN_CONTINUOUS_MEDIUM_VOLTAGE /  FAN_MAX_VOLTAGE;
-const pwm_duty_t FAN_OUT_CONTINUOUS_HIGH_DUTY_VALUE = (uint32_t) ANALOG_OUT_MAX * FAN_CONTINUOUS_HIGH_VOLTAGE /  FAN_MAX_VOLTAGE;
+const pwm_duty_t FAN_OUT_INTERVAL_FAN_ON_DUTY_VALUE = fanDutyValueFor(INTERVAL_FAN_ON_VOLTAGE);
 
-const pwm_duty_t FAN_OUT_INTERVAL_FAN_ON_DUTY_VALUE = (uint32_t) ANALOG_OUT_MAX * INTERVAL_FAN_ON_VOLTAGE /  FAN_MAX_VOLTAGE;
+// Interval cycle for the current intensity
+typedef struct {
+  pwm_duty_t dutyValue;
+  time16_s_t onDuration;      // [s]
+  time16_s_t pauseDuration;   // [s] 0 => the fan runs continuously
+} IntervalPlan;
+
+IntervalPlan planInterval(FanIntensity intensity);
+
+// [s] shorter pauses are not worth a soft stop and start => the fan runs through
+const time16_s_t INTERVAL_MIN_PAUSE_DURATION = (FAN_START_DURATION_MS + FAN_STOP_DURATION_MS) / 1000;
 
 // Fan soft start and soft stop:
 const pwm_duty_t FAN_START_INCREMENT = (pwm_duty_t) ((uint32_t) (ANALOG_OUT_MAX - FAN_OUT_LOW_THRESHOLD) * SPEED_TRANSITION_CYCLE_DURATION_MS / FAN_START_DURATION_MS);
@@ -29,8 +41,14 @@ volatile pwm_duty_t fanTargetDutyValue = FAN_OUT_FAN_OFF; // value derived from
 
 volatile time32_s_t intervalPhaseBeginTime = 0; // [s]
 volatile time32_s_t intervalPauseDuration;      // [s]
+IntervalPlan intervalPlan = {FAN_OUT_INTERVAL_FAN_ON_DUTY_VALUE, INTERVAL_FAN_ON_DURATION, INTERVAL_PAUSE_LONG_DURATION};
 
 time32_ms_t lastPauseBlipTime = 0;
+
+// Start / stop dwell (see FAN_MIN_RUN_DURATION)
+volatile time32_s_t dwellEnd = 0;                 // [s]
+volatile Event heldEvent = EVENT_NONE;
+volatile uint16_t suppressedCycles = 0;
   
 // (function pointers)
 extern void (* modeChangedHandler)();
@@ -48,15 +66,52 @@ void handleIntensityChange() {
   handleStateTransition(INTENSITY_CHANGED);
 }
 
+// Saves the state for a warm restart; ISR-safe
+void retainFanControlState() {
+  FanControlSnapshot snapshot;
+  snapshot.fanState = fanState;
+  snapshot.dutyValue = getFanDutyCycle();
+  snapshot.targetDutyValue = fanTargetDutyValue;
+  snapshot.intervalPhaseBeginTime = intervalPhaseBeginTime;
+  snapshot.intervalPauseDuration = intervalPauseDuration;
+  retainFanControl(& snapshot);
+}
+
+// Resumes where the controller was before a watchdog or brown-out reset: no soft start from zero
+bool resumeFanControl() {
+  FanControlSnapshot snapshot;
+  if (! restoreFanControl(& snapshot)) {
+    return false;
+  }
+  fanState = (FanState) snapshot.fanState;
+  fanTargetDutyValue = snapshot.targetDutyValue;
+  intervalPhaseBeginTime = snapshot.intervalPhaseBeginTime;
+  intervalPauseDuration = snapshot.intervalPauseDuration;
+  intervalPlan = planInterval(getFanIntensity());
+  if (fanState != FAN_OFF && fanState != FAN_PAUSING) {
+    setFanPower(true);
+    configOutput(FAN_PWM_OUT_PIN);
+    setFanDutyCycle(snapshot.dutyValue);
+  }
+  // the switches may have been changed while the MCU was resetting
+  handleStateTransition(MODE_CHANGED);
+  handleStateTransition(INTENSITY_CHANGED);
+  return true;
+}
+
 void initFanControl() {
   // Install input-change handlers (= assign function pointers)
   modeChangedHandler = handleModeChange;
   intensityChangedHandler = handleIntensityChange; 
 
   getFanIntensity(); // ensure initialisation
+  if (resumeFanControl()) {
+    return;
+  }
   if (getFanMode() != MODE_OFF) {
     handleStateTransition(MODE_CHANGED);
   }
+  retainFanControlState();
 }
 
 //
@@ -77,15 +132,21 @@ time32_ms_t getIntervalPauseDuration() {
   return intervalPauseDuration;
 }
 
+// [s]
+time16_s_t getIntervalOnDuration() {
+  return intervalPlan.onDuration;
+}
+
 // Applicable only in mode CONTINUOUS
+// Lowest duty value that delivers the airflow of the intensity (inverse of the fan profile)
 pwm_duty_t mapToFanDutyValue(FanIntensity intensity) {
   switch(intensity) {
     case INTENSITY_HIGH: 
-      return FAN_OUT_CONTINUOUS_HIGH_DUTY_VALUE;
+      return fanDutyValueFor(fanVoltageForAirflow(FAN_CONTINUOUS_HIGH_AIRFLOW));
     case INTENSITY_MEDIUM: 
-      return FAN_OUT_CONTINUOUS_MEDIUM_DUTY_VALUE;
+      return fanDutyValueFor(fanVoltageForAirflow(FAN_CONTINUOUS_MEDIUM_AIRFLOW));
     default: 
-      return FAN_OUT_CONTINUOUS_LOW_DUTY_VALUE;
+      return fanDutyValueFor(fanVoltageForAirflow(FAN_CONTINUOUS_LOW_AIRFLOW));
   }
 }
 
@@ -102,46 +163,99 @@ time16_s_t mapToIntervalPauseDuration(FanIntensity intensity) {
   }
 }
   
-#ifdef VERBOSE
-  const char* fanStateName(FanState state) {
-    switch (state) {
-      case FAN_OFF: return "OFF";
-      case FAN_SPEEDING_UP: return "SPEEDING UP";
-      case FAN_STEADY: return "STEADY";
-      case FAN_SLOWING_DOWN: return "SLOWING DOWN";
-      case FAN_PAUSING: return "PAUSE";
-      default: return "?";
-    }
+// Interval cycle with the least energy that moves the air volume of the fixed on-phase at INTERVAL_FAN_ON_VOLTAGE.
+// Air volume per cycle = airflow x on-duration; energy per cycle = power x on-duration.
+// Candidates: the profile points and the voltage at which the fan delivers the air volume without pausing.
+IntervalPlan planInterval(FanIntensity intensity) {
+  time16_s_t cycle = INTERVAL_FAN_ON_DURATION + mapToIntervalPauseDuration(intensity);
+  IntervalPlan plan = {FAN_OUT_INTERVAL_FAN_ON_DUTY_VALUE, INTERVAL_FAN_ON_DURATION, cycle - INTERVAL_FAN_ON_DURATION};
+  if (! INTERVAL_ISO_AIRFLOW) {
+    return plan;
   }
   
-  const char* eventName(Event event) {
-    switch (event) {
-      case EVENT_NONE: return "NONE";
-      case MODE_CHANGED: return "Mode changed";
-      case INTENSITY_CHANGED: return "Intensity changed";
-      case TARGET_SPEED_REACHED: return "Speed reached";
-      case INTERVAL_PHASE_ENDED: return "Phase ended";
-      default: return "?";
+  uint32_t airVolume = (uint32_t) fanAirflow(INTERVAL_FAN_ON_VOLTAGE) * INTERVAL_FAN_ON_DURATION;  // [‰ x s]
+  uint32_t minEnergy = (uint32_t) fanPower(INTERVAL_FAN_ON_VOLTAGE) * INTERVAL_FAN_ON_DURATION;   // [mW x s]
+  for (uint8_t point = 0; point <= FAN_PROFILE_POINTS; point++) {
+    millivolt_t voltage = point < FAN_PROFILE_POINTS 
+        ? fanProfileVoltage(point) 
+        : fanVoltageForAirflow((airVolume + cycle - 1) / cycle);
+    permille_t airflow = fanAirflow(voltage);
+    uint32_t onDuration = (airVolume + airflow - 1) / airflow;  // [s] round up
+    if (onDuration + INTERVAL_MIN_PAUSE_DURATION > cycle && onDuration <= cycle) {
+      onDuration = cycle;
+    }
+    uint32_t energy = (uint32_t) fanPower(voltage) * onDuration;
+    if (onDuration <= cycle && energy < minEnergy) {
+      minEnergy = energy;
+      plan.dutyValue = fanDutyValueFor(voltage);
+      plan.onDuration = onDuration;
+      plan.pauseDuration = cycle - onDuration;
     }
   }
-#endif
+  return plan;
+}
 
+// Returns true if the fan may start or stop now; otherwise the event is held back until the dwell time has passed
+bool dwellPermits(Event event, time32_s_t now) {
+  if ((duration32_s_t) (dwellEnd - now) <= 0) {
+    return true;
+  }
+  heldEvent = event;
+  TRACE(TRACE_DWELL_HELD, event, dwellEnd - now);
+  return false;
+}
+
+// The fan has not been stopped and restarted: saves a spin-up from standstill
+void countSuppressedCycle() {
+  if (suppressedCycles < UINT16_MAX) {
+    suppressedCycles++;
+  }
+  TRACE(TRACE_CYCLE_SUPPRESSED, fanState, suppressedCycles);
+}
+
+// End of an on-phase in mode INTERVAL: plans the next cycle for the current intensity. A plan with pause stops the fan,
+// a plan without pause keeps it running at the plan's duty value (no soft stop and start).
+void endIntervalOnPhase(time32_s_t now) {
+  intervalPlan = planInterval(getFanIntensity());
+  intervalPauseDuration = intervalPlan.pauseDuration;
+  if (intervalPlan.pauseDuration > 0) {
+    if (! dwellPermits(INTERVAL_PHASE_ENDED, now)) {
+      return;
+    }
+    fanState = FAN_SLOWING_DOWN;
+    fanTargetDutyValue = FAN_OUT_FAN_OFF;
+  } else if (intervalPlan.dutyValue > getFanDutyCycle()) {
+    fanState = FAN_SPEEDING_UP;
+    fanTargetDutyValue = intervalPlan.dutyValue;
+  } else if (intervalPlan.dutyValue < getFanDutyCycle()) {
+    fanState = FAN_SLOWING_DOWN;
+    fanTargetDutyValue = intervalPlan.dutyValue;
+  }
+  intervalPhaseBeginTime = now;
+}
+
+// Powers the fan with duty cycle 0%: the first speedUp() FAN_POWER_SETTLE_DURATION_MS later starts the fan at FAN_OUT_LOW_THRESHOLD
 void fanOn(FanMode mode) {
+  dwellEnd = wdtTime_s() + FAN_MIN_RUN_DURATION;
+  setFanPower(true);
   configOutput(FAN_PWM_OUT_PIN);
-  setFanDutyCycle(FAN_OUT_LOW_THRESHOLD);
+  setFanDutyCycle(FAN_OUT_FAN_OFF);
   if (mode == MODE_CONTINUOUS) {
     fanTargetDutyValue = mapToFanDutyValue(getFanIntensity());
   } else { /* getFanMode() == MODE_INTERVAL */
-    fanTargetDutyValue = FAN_OUT_INTERVAL_FAN_ON_DUTY_VALUE;
+    intervalPlan = planInterval(getFanIntensity());
+    fanTargetDutyValue = intervalPlan.dutyValue;
   }
 }
 
 void fanOff(FanMode mode) {
   setFanDutyCycle(FAN_OUT_FAN_OFF);
   if (mode == MODE_INTERVAL) {
-     intervalPauseDuration = mapToIntervalPauseDuration(getFanIntensity());
+     intervalPlan = planInterval(getFanIntensity());
+     intervalPauseDuration = intervalPlan.pauseDuration;
   }
   configInput(FAN_PWM_OUT_PIN);
+  setFanPower(false);   // no idle current through the fan while it stands still
 }
 
 void speedUp() {
@@ -150,23 +264,23 @@ void speedUp() {
   // ensure we don't overrun the max value of uint8_t when incrementing:
   pwm_duty_t increment = min(ANALOG_OUT_MAX - transitioningDutyValue, FAN_START_INCREMENT);
 
-  if (transitioningDutyValue + increment < fanTargetDutyValue) {
+  if (transitioningDutyValue < FAN_OUT_LOW_THRESHOLD) {
+    // fan power has settled (see fanOn()) --> start right at the lowest speed the fan can run at
+    transitioningDutyValue = min(FAN_OUT_LOW_THRESHOLD, fanTargetDutyValue);
+  } else if (transitioningDutyValue + increment < fanTargetDutyValue) {
     transitioningDutyValue += increment;
   } else {
     transitioningDutyValue = fanTargetDutyValue;
   }
-  #ifdef VERBOSE
-    Serial.print("Speeding up: ");
-    Serial.println(transitioningDutyValue);
-    Serial.flush();
-  #endif
+  TRACE(TRACE_SPEED_UP, fanState, transitioningDutyValue);
   
   setFanDutyCycle(transitioningDutyValue);
+  retainFanControlState();
   if (getFanDutyCycle() >= fanTargetDutyValue) {
     handleStateTransition(TARGET_SPEED_REACHED);
     
-  } else if (BLINK_LED_DURING_SPEED_TRANSITION) {
-    invertStatusLED();
+  } else if (BLINK_LED_DURING_SPEED_TRANSITION && ! isLedPatternPlaying()) {
+    playLedPattern(LED_PATTERN_SPEED_TRANSITION);
   }
 }
 
@@ -185,18 +299,15 @@ void slowDown() {
   } else {
     transitioningDutyValue = max(fanTargetDutyValue, FAN_OUT_LOW_THRESHOLD);
   }
-  #ifdef VERBOSE
-    Serial.print("Slowing down: ");
-    Serial.println(transitioningDutyValue);
-    Serial.flush();
-  #endif
+  TRACE(TRACE_SLOW_DOWN, fanState, transitioningDutyValue);
   
   setFanDutyCycle(transitioningDutyValue);
+  retainFanControlState();
   if (getFanDutyCycle() <= fanTargetDutyValue) {
     handleStateTransition(TARGET_SPEED_REACHED);
     
-  } else if (BLINK_LED_DURING_SPEED_TRANSITION) {
-    invertStatusLED();
+  } else if (BLINK_LED_DURING_SPEED_TRANSITION && ! isLedPatternPlaying()) {
+    playLedPattern(LED_PATTERN_SPEED_TRANSITION);
   }
 }
 
@@ -206,17 +317,20 @@ void handleStateTransition(Event event) {
   if (event == EVENT_NONE) {
     return;
   }
+  ISR_STATS_ENTER(ISR_STATS_TRANSITION);
   time32_s_t now = wdtTime_s();
-  #ifdef VERBOSE
-    FanState beforeState = fanState;
-  #endif
+  FanState beforeState = fanState;
+  Event beforeHeld = heldEvent;
+  if (event == MODE_CHANGED) {
+    heldEvent = EVENT_NONE;   // the switch position decides anew below
+  }
   
   switch(fanState) {
     
     case FAN_OFF:
       switch(event) {
         case MODE_CHANGED:
-          if (getFanMode() != MODE_OFF) {
+          if (getFanMode() != MODE_OFF && dwellPermits(event, now)) {
             fanState = FAN_SPEEDING_UP;
             fanOn(getFanMode());
             intervalPhaseBeginTime = now;
@@ -235,7 +349,8 @@ void handleStateTransition(Event event) {
     case FAN_SPEEDING_UP: 
       switch(event) {
         case MODE_CHANGED:
-          if (getFanMode() == MODE_OFF) {
+          // held back: the fan reaches its target speed first, then waits for the end of FAN_MIN_RUN_DURATION
+          if (getFanMode() == MODE_OFF && dwellPermits(event, now)) {
             fanState = FAN_SLOWING_DOWN;
             fanTargetDutyValue = FAN_OUT_FAN_OFF;
           }
@@ -251,7 +366,7 @@ void handleStateTransition(Event event) {
               fanTargetDutyValue = newTargetDutyValue;
             } else { /* newTargetDutyValue == getFanDutyCycle() */
               fanState = FAN_STEADY;
-              setStatusLED(LOW);
+              stopLedPattern();
             }
           }
           break;
@@ -259,7 +374,7 @@ void handleStateTransition(Event event) {
         case TARGET_SPEED_REACHED: 
           fanState = FAN_STEADY;
           intervalPhaseBeginTime = now;
-          setStatusLED(LOW);
+          stopLedPattern();
           break;
 
         default:
@@ -270,7 +385,7 @@ void handleStateTransition(Event event) {
     case FAN_STEADY: 
       switch(event) {
         case MODE_CHANGED: 
-          if (getFanMode() == MODE_OFF) {
+          if (getFanMode() == MODE_OFF && dwellPermits(event, now)) {
             fanState = FAN_SLOWING_DOWN;
             fanTargetDutyValue = FAN_OUT_FAN_OFF;
           }
@@ -286,13 +401,14 @@ void handleStateTransition(Event event) {
               fanState = FAN_SLOWING_DOWN;
               fanTargetDutyValue = newTargetDutyValue;
             } 
+          } else if (getFanMode() == MODE_INTERVAL && intervalPlan.pauseDuration == 0) {
+            // a plan without pause has no phase end at which the new intensity would take effect
+            endIntervalOnPhase(now);
           }
           break;
 
         case INTERVAL_PHASE_ENDED:
-          fanState = FAN_SLOWING_DOWN;
-          fanTargetDutyValue = FAN_OUT_FAN_OFF;
-          intervalPhaseBeginTime = now;
+          endIntervalOnPhase(now);
           break;
           
         default:
@@ -305,7 +421,12 @@ void handleStateTransition(Event event) {
         case MODE_CHANGED:
           if (getFanMode() == MODE_OFF) {
             fanTargetDutyValue = FAN_OUT_FAN_OFF;
-          }
+          } else if (getFanMode() == MODE_CONTINUOUS && fanTargetDutyValue == FAN_OUT_FAN_OFF) {
+            // switched on again before the fan has stopped => back to speed from where it is
+            fanState = FAN_SPEEDING_UP;
+            fanTargetDutyValue = mapToFanDutyValue(getFanIntensity());
+            countSuppressedCycle();
+          } // MODE_INTERVAL: the interval cycle starts with its pause
           break;
           
         case INTENSITY_CHANGED: 
@@ -318,7 +439,7 @@ void handleStateTransition(Event event) {
               fanTargetDutyValue = newTargetDutyValue;
             } else {  /* newTargetDutyValue == getFanDutyCycle() */
               fanState = FAN_STEADY;
-              setStatusLED(LOW);
+              stopLedPattern();
             }
           }
           break;
@@ -327,15 +448,17 @@ void handleStateTransition(Event event) {
           if (getFanMode() == MODE_OFF) {
             fanState = FAN_OFF;
             fanOff(MODE_INTERVAL);
-          } else if (getFanMode() == MODE_CONTINUOUS) {
-            fanState = FAN_STEADY;
+            dwellEnd = now + FAN_MIN_REST_DURATION;
+          } else if (getFanMode() == MODE_CONTINUOUS || fanTargetDutyValue != FAN_OUT_FAN_OFF) {
+            fanState = FAN_STEADY;   // MODE_INTERVAL: new plan without pause, see endIntervalOnPhase()
           } else {  // getFanMode() == MODE_INTERVAL
             fanState = FAN_PAUSING;
             fanOff(MODE_INTERVAL);
+            dwellEnd = now + FAN_MIN_REST_DURATION;
             intervalPhaseBeginTime = now;
             resetPauseBlip();
           }
-          setStatusLED(LOW);
+          stopLedPattern();
           break;
 
         default:
@@ -349,15 +472,17 @@ void handleStateTransition(Event event) {
           if (getFanMode() == MODE_OFF) {
             fanState = FAN_OFF;
             fanOff(MODE_INTERVAL);
-          } else if (getFanMode() == MODE_CONTINUOUS) {
+          } else if (getFanMode() == MODE_CONTINUOUS && dwellPermits(event, now)) {
             fanState = FAN_SPEEDING_UP;
             fanOn(MODE_CONTINUOUS);
           }
           break;
           
         case INTENSITY_CHANGED: 
-          intervalPauseDuration = mapToIntervalPauseDuration(getFanIntensity());
-          if ((duration32_s_t) (now - intervalPhaseBeginTime) >= intervalPauseDuration) {  // pause is over
+          intervalPlan = planInterval(getFanIntensity());
+          intervalPauseDuration = intervalPlan.pauseDuration;
+          if ((duration32_s_t) (now - intervalPhaseBeginTime) >= intervalPauseDuration  // pause is over
+              && dwellPermits(event, now)) {
             fanState = FAN_SPEEDING_UP;
             fanOn(MODE_INTERVAL);
             intervalPhaseBeginTime = now;
@@ -365,9 +490,11 @@ void handleStateTransition(Event event) {
           break;
 
         case INTERVAL_PHASE_ENDED:
-          fanState = FAN_SPEEDING_UP;
-          fanOn(MODE_INTERVAL);
-          intervalPhaseBeginTime = now;
+          if (dwellPermits(event, now)) {
+            fanState = FAN_SPEEDING_UP;
+            fanOn(MODE_INTERVAL);
+            intervalPhaseBeginTime = now;
+          }
           break;
           
         default: 
@@ -376,14 +503,14 @@ void handleStateTransition(Event event) {
       break;
   }
   
-  #ifdef VERBOSE
-    Serial.print("State ");
-    Serial.print(fanStateName(beforeState));
-    Serial.print(" -- [");
-    Serial.print(eventName(event));
-    Serial.print("] --> State ");
-    Serial.println(fanStateName(fanState));
-  #endif
+  // a start or stop held back has been withdrawn by the switch
+  if (beforeHeld != EVENT_NONE && heldEvent == EVENT_NONE && fanState == beforeState) {
+    countSuppressedCycle();
+  }
+  
+  TRACE(TRACE_TRANSITION, fanState, (beforeState << 8) | event);
+  retainFanControlState();
+  ISR_STATS_EXIT(ISR_STATS_TRANSITION);
 }
 
 void resetPauseBlip() {
@@ -393,3 +520,24 @@ void resetPauseBlip() {
 time32_s_t getLastPauseBlipTime() {
   return lastPauseBlipTime;
 }
+
+Event getHeldEvent() {
+  return heldEvent;
+}
+
+time32_s_t getDwellEnd() {
+  return dwellEnd;
+}
+
+void releaseHeldEvent() {
+  Event event;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    event = heldEvent;
+    heldEvent = EVENT_NONE;
+  }
+  handleStateTransition(event);
+}
+
+uint16_t getSuppressedCycles() {
+  return suppressedCycles;
+}
@@ -4,6 +4,7 @@
   #include <Arduino.h> 
   #include "io_util.h"
   #include "fan_io.h"
+  #include "fan_profile.h"
   
   // --------------------
   // CONFIGURABLE VALUES
@@ -12,10 +13,11 @@
   // Durations are always in seconds [s], unless where symbol name ends in _MS --> milliseconds [ms]
   // --------------------
 
-  // Continuous operation:
-  const millivolt_t FAN_CONTINUOUS_LOW_VOLTAGE = FAN_LOW_THRESHOLD_VOLTAGE;   // [mV] do not set lower than FAN_LOW_THRESHOLD_VOLTAGE
-  const millivolt_t FAN_CONTINUOUS_MEDIUM_VOLTAGE = 8600;                     // [mV]
-  const millivolt_t FAN_CONTINUOUS_HIGH_VOLTAGE = FAN_MAX_VOLTAGE;            // [mV]
+  // Continuous operation: airflow in [‰] of the airflow at FAN_MAX_VOLTAGE; the fan runs at the lowest voltage that 
+  // delivers it according to the fan profile (see fan_profile.h), never below FAN_LOW_THRESHOLD_VOLTAGE
+  const permille_t FAN_CONTINUOUS_LOW_AIRFLOW = 0;          // [‰] 0 --> FAN_LOW_THRESHOLD_VOLTAGE
+  const permille_t FAN_CONTINUOUS_MEDIUM_AIRFLOW = 660;     // [‰]
+  const permille_t FAN_CONTINUOUS_HIGH_AIRFLOW = 1000;      // [‰]
   
   // Interval operation:
   const millivolt_t INTERVAL_FAN_ON_VOLTAGE = FAN_MAX_VOLTAGE;     // [mV]
@@ -25,14 +27,28 @@
   const duration16_s_t INTERVAL_PAUSE_MEDIUM_DURATION = 600;          // [s]
   const duration16_s_t INTERVAL_PAUSE_LONG_DURATION = 3600 - INTERVAL_FAN_ON_DURATION;           // [s]
   
+  // Iso-airflow: deliver the air volume of INTERVAL_FAN_ON_VOLTAGE x INTERVAL_FAN_ON_DURATION per interval cycle at the
+  // voltage that needs the least energy (see fan_profile.h), i.e. usually slower and longer. The cycle time is kept.
+  const bool INTERVAL_ISO_AIRFLOW = true;
+  
   // Fan soft start and stop:
   const duration16_ms_t FAN_START_DURATION_MS = 5000;                  // [ms] duration from full stop to full throttle
   const duration16_ms_t FAN_STOP_DURATION_MS = 10000;                   // [ms] duration from full throttle to full stop
   const bool  BLINK_LED_DURING_SPEED_TRANSITION = true;
   
+  // Start / stop dwell: once started, the fan runs at least FAN_MIN_RUN_DURATION (from the start of its spin-up); once
+  // stopped, it rests at least FAN_MIN_REST_DURATION. A start or stop requested earlier is held back until then and is
+  // dropped if the request is withdrawn meanwhile (a suppressed start/stop cycle, see TRACE_CYCLE_SUPPRESSED). 0 --> off
+  const duration16_s_t FAN_MIN_RUN_DURATION = 30;                     // [s]
+  const duration16_s_t FAN_MIN_REST_DURATION = 15;                    // [s]
+  
   // Control cycle: PWM parameters are set only once per cycle
   const duration16_ms_t SPEED_TRANSITION_CYCLE_DURATION_MS = 200;      // [ms]
   
+  // Fan power (MOSFET) is switched off while the fan stands still; after switching it on, the fan electronics need 
+  // this time before the first PWM pulse --> delays the first speed-up cycle after fanOn()
+  const duration16_ms_t FAN_POWER_SETTLE_DURATION_MS = 100;            // [ms]
+  
   
   //
   // CONTROLLER STATES
@@ -55,8 +71,14 @@
 
   time32_s_t getIntervalPhaseBeginTime(); // [s]
   time32_s_t getIntervalPauseDuration();  // [s]
+  time16_s_t getIntervalOnDuration();     // [s]
   
   void resetPauseBlip();  // reset time
   time32_s_t getLastPauseBlipTime();      // [s]
 
+  Event getHeldEvent();                   // start or stop held back by the dwell times; EVENT_NONE: none
+  time32_s_t getDwellEnd();               // [s] no start or stop before
+  void releaseHeldEvent();                // applies the held start or stop once the dwell time has passed
+  uint16_t getSuppressedCycles();         // start/stop cycles suppressed since boot
+
 #endif
@@ -5,6 +5,10 @@
 #include "low_power.h"
 #include "wdt_time.h"
 #include "fan_control.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "led_pattern.h"
+#include "warm_restart.h"
 
 //
 //  #define VERBOSE --> see fan_io.h
@@ -25,27 +29,41 @@ void setup() {
   configPWM1();
   configLowPower();
   configWatchdogTime();
-
-  delay(1000);
-  flashLED(STATUS_LED_OUT_PIN, 3);
-  delay(2000);
-  
-  initFanControl();
+  disableArduinoTimer0();  // all timing is based on the watchdog => no Timer0 overflow wake-ups in IDLE sleep
+  configIsrStats();
 
   #ifdef VERBOSE
     // Setup Serial Monitor
-    Serial.begin(38400);
-    
-    Serial.print("F_CPU: ");
-    Serial.println(F_CPU);
-    Serial.print("Fan out max: ");
-    Serial.println(ANALOG_OUT_MAX);
-    Serial.print("Fan out low threshold: ");
-    Serial.println(FAN_OUT_LOW_THRESHOLD);
+    Serial.begin(38400);   // binary trace stream --> decode with tools/trace_decode.py
+    TRACE(TRACE_BOOT, getResetFlags(), F_CPU / 1000);
     #define USART0_SERIAL USART0_ON
   #else
     #define USART0_SERIAL USART0_OFF
   #endif
+
+  // Fast boot: restore the fan state right away (resumes after a watchdog or brown-out reset, see warm_restart.h), 
+  // show the boot animation afterwards.
+  // Boot-to-fan-on time = RESET pin rising edge --> FAN_POWER_ON_OUT_PIN rising edge
+  debounceSwitch();   // let the input pull-ups settle before the switches are read
+  initFanControl();
+  // asynchronous, played back while the CPU sleeps; a watchdog reset means the program had hung
+  playLedPattern(getResetFlags() & _BV(WDRF) ? LED_PATTERN_FAULT : LED_PATTERN_BOOT);
+}
+
+
+// A start or stop held back by the minimum run / rest time: sleep until it is due (a switch change wakes up earlier),
+// then apply it. Returns false if nothing is held back.
+bool waitForHeldTransition(time32_s_t now) {
+  if (getHeldEvent() == EVENT_NONE) {
+    return false;
+  }
+  duration32_s_t remainingDwell = getDwellEnd() - now;
+  if (remainingDwell > 0) {
+    delayInterruptible_seconds(remainingDwell);
+  } else {
+    releaseHeldEvent();
+  }
+  return true;
 }
 
 
@@ -56,21 +74,32 @@ void loop() {
 
   switch(getFanState()) {
     case FAN_OFF:
-      waitForUserInput();  // blocking wait
+      if (! waitForHeldTransition(now)) {
+        waitForUserInput();  // blocking wait
+      }
       break;
       
     case FAN_SPEEDING_UP:
-      // When transistioning from OFF or STEADY, duty value is set to minimum -> let fan speed up to this first -> delay first
-      if (! delayInterruptible_millis(SPEED_TRANSITION_CYCLE_DURATION_MS)) {
+    {
+      // When transistioning from OFF or PAUSING, fan power has just been switched on -> let it settle first -> delay first
+      // When transistioning from STEADY or SLOWING_DOWN, the fan runs at its current duty value -> delay first as well
+      duration16_ms_t cycleDuration = getFanDutyCycle() < FAN_OUT_LOW_THRESHOLD
+          ? FAN_POWER_SETTLE_DURATION_MS 
+          : SPEED_TRANSITION_CYCLE_DURATION_MS;
+      if (! delayInterruptible_millis(cycleDuration)) {
         speedUp();
       }
-      break;
+    }
+    break;
       
     case FAN_STEADY:
     {
+      if (waitForHeldTransition(now)) {
+        break;
+      }
       if (getFanMode() == MODE_INTERVAL) {
         // sleep until active phase is over
-        duration16_s_t remainingPhaseDuration = INTERVAL_FAN_ON_DURATION - (now - getIntervalPhaseBeginTime());  // can be < 0
+        duration16_s_t remainingPhaseDuration = getIntervalOnDuration() - (now - getIntervalPhaseBeginTime());  // can be < 0
         // Serial.print("remainingPhaseDuration: ");
         // Serial.print(remainingPhaseDuration);
         // Serial.print(", now: ");
@@ -96,8 +125,12 @@ void loop() {
       
     case FAN_PAUSING:
     {
-      // sleep until next LED flash or until pause is over (whatever will happen first)
-      duration16_s_t remainingPhaseDuration = getIntervalPauseDuration() - (now - getIntervalPhaseBeginTime());  // can be < 0
+      // sleep until next LED flash or until pause is over (whatever will happen first); a restart held back by the 
+      // minimum rest time extends the pause
+      bool held = getHeldEvent() != EVENT_NONE;
+      duration16_s_t remainingPhaseDuration = held 
+        ? getDwellEnd() - now 
+        : getIntervalPauseDuration() - (now - getIntervalPhaseBeginTime());  // can be < 0
         // Serial.print("remainingPhaseDuration: ");
         // Serial.print(remainingPhaseDuration);
         // Serial.print(", now: ");
@@ -122,6 +155,8 @@ void loop() {
             resetPauseBlip();
           }
         }
+      } else if (held) {
+        releaseHeldEvent();
       } else {
         handleStateTransition(INTERVAL_PHASE_ENDED);
       }
@@ -1,4 +1,9 @@
 #include "fan_io.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "low_power.h"
+#include "led_pattern.h"
+#include "mem_stats.h"
 
 bool statusLEDState = LOW;
 
@@ -26,6 +31,8 @@ void configInputPins() {
 
 void configOutputPins() {
   configOutput(STATUS_LED_OUT_PIN);
+  configOutput(FAN_POWER_ON_OUT_PIN);
+  setFanPower(false);
   #if defined(__AVR_ATmega328P__)
     configOutput(SLEEP_LED_OUT_PIN);
   #endif
@@ -50,10 +57,7 @@ bool updateFanModeFromInputPins() {
   } else {
     value = MODE_INTERVAL;
   }
-  #ifdef VERBOSE
-    Serial.print("Read Fan Mode: ");
-    Serial.println(value == MODE_INTERVAL ? "INTERVAL" : (value == MODE_CONTINUOUS ? "CONTINUOUS" :"OFF"));
-  #endif
+  TRACE(TRACE_MODE_READ, 0, value);
   
   if (value != fanMode) {
     fanMode = value;
@@ -73,10 +77,7 @@ bool updateFanIntensityFromInputPins() {
   } else {
     value = INTENSITY_MEDIUM;
   }
-  #ifdef VERBOSE
-    Serial.print("Read Fan Intensity: ");
-    Serial.println(value == INTENSITY_LOW ? "LOW" : (value == INTENSITY_HIGH ? "HIGH" :"MEDIUM"));
-  #endif
+  TRACE(TRACE_INTENSITY_READ, 0, value);
   
   if (value != fanIntensity) {
     fanIntensity = value;
@@ -132,9 +133,15 @@ void configInt0Interrupt() {
 
 
 ISR (INT0_vect) {       // Interrupt service routine for INT0 on PB2
+  cpuClockFull();       // debounceSwitch() delays are based on F_CPU
+  MEM_STATS_ISR_ENTER();
+  countWakeup(WAKEUP_PIN_CHANGE);
   debounceSwitch();
+  ISR_STATS_ENTER(ISR_STATS_INT0);   // after the debounce, see isr_stats.h
   interruptSource = MODE_CHANGED_INTERRUPT;
   modeChangedHandler();
+  MEM_STATS_ISR_EXIT();
+  ISR_STATS_EXIT(ISR_STATS_INT0);
 }
 
 void configPinChangeInterrupts() {
@@ -154,7 +161,11 @@ void configPinChangeInterrupts() {
 
 
 ISR (PCINT0_vect) {       // Interrupt service routine for Pin Change Interrupt Request 0
+  cpuClockFull();       // debounceSwitch() delays are based on F_CPU
+  MEM_STATS_ISR_ENTER();
+  countWakeup(WAKEUP_PIN_CHANGE);
   debounceSwitch();
+  ISR_STATS_ENTER(ISR_STATS_PCINT0);   // after the debounce, see isr_stats.h
   if (updateFanModeFromInputPins()) {
     interruptSource = MODE_CHANGED_INTERRUPT;
     modeChangedHandler();
@@ -162,8 +173,15 @@ ISR (PCINT0_vect) {       // Interrupt service routine for Pin Change Interrupt
     interruptSource = INTENSITY_CHANGED_INTERRUPT;
     intensityChangedHandler();
   }
+  MEM_STATS_ISR_EXIT();
+  ISR_STATS_EXIT(ISR_STATS_PCINT0);
 }
 
+#if defined(__AVR_ATmega328P__)
+  // Pin Change Interrupt Request 2 (intensity switch) is enabled as well => same handler; without it the MCU would reset
+  ISR (PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+
 void configPWM1() {
   #if defined(__AVR_ATmega328P__)
     // Arduino default PWM frequency = 490 Hz
@@ -178,9 +196,11 @@ void configPWM1() {
     // Waveform Generator Mode (WGM):
     // -> See Table 15-5 of ATmega328P Datasheet
     // - 4 bits, distributed across TCCR1A and TCCR1B 
-    // - Set to mode #10: "PWM, phase correct, 9-bit, TOP = ICR1" 
-    //   | WGM13 | WGM12 | WGM11 | WGM10 |
-    //   |   1   |   0   |   1   |   0   |
+    // - Set to mode #8: "PWM, phase and frequency correct, TOP = ICR1" 
+    //   | WGM13 | WGM12 | WGM11 | WGM10 |
+    //   |   1   |   0   |   0   |   0   |
+    //   Unlike mode #10, the OCR1x are updated and TOV1 is set at BOTTOM => a new TOP (ICR1 is NOT double-buffered) and 
+    //   the new duty take effect in the same period when TOP is written right after BOTTOM (CPU clock scaling, see scalePWM1())
 
     // Compare Output Mode for chanlels A / B (COM)
     // !!! Channels A and B have NOTHING TO DO WITH CONTROL REGISTERS A and B !!!
@@ -197,10 +217,9 @@ void configPWM1() {
   
     // Configure Timer/Counter1 Control Register A (TCCR1A) 
     // | COM1A1 | COM1A0 | COM1B1 | COM1B0 |  -  |  -  | WGM11 | WGM10 |
-    // |   1    |   0    |    1   |   0    |  0  |  0  |   1   |   0   |
+    // |   1    |   0    |    1   |   0    |  0  |  0  |   0   |   0   |
     TCCR1A = _BV(COM1A1)
-          | _BV(COM1B1)
-          | _BV(WGM11);
+          | _BV(COM1B1);
 
     // Configure Timer/Counter1 Control Register B (TCCR1B) 
     // - Input Capture Noise Canceler (ICNC)
@@ -248,14 +267,53 @@ void configPWM1() {
   #endif
 }
 
+uint8_t pwmClockShift = 0;   // Timer1 runs on the CPU clock divided by 2^pwmClockShift
+
+// Duty value for the current clock scaling; a partial duty cycle never becomes 0% 
+pwm_duty_t scaledDutyCycle(pwm_duty_t value) {
+  if (value == ANALOG_OUT_MIN || value == ANALOG_OUT_MAX) {
+    return value;
+  }
+  pwm_duty_t scaled = value >> pwmClockShift;
+  return scaled > ANALOG_OUT_MIN ? scaled : ANALOG_OUT_MIN + 1;
+}
+
+void setFanPower(bool on) {
+  digitalWrite(FAN_POWER_ON_OUT_PIN, on);
+}
+
 void setFanDutyCycle(pwm_duty_t value) {
   fanDutyCycleValue = value;
   #if defined(__AVR_ATmega328P__)
-    analogWrite(FAN_PWM_OUT_PIN, value); // Send PWM signal
+    analogWrite(FAN_PWM_OUT_PIN, scaledDutyCycle(value)); // Send PWM signal
+
+  #elif defined(__AVR_ATtiny85__)
+    OCR1A = scaledDutyCycle(value);
+  #endif
+}
+
+// TOP (ICR1 / OCR1C) is not double-buffered: a TOP below the counter value would let Timer1 run on to 0xFFFF / 0xFF 
+// => one PWM period of several ms. TOP is therefore written right after the counter has wrapped, busy waiting for at
+// most one PWM period with interrupts disabled.
+void scalePWM1(uint8_t clockShift) {
+  uint8_t oldSREG = SREG;
+  cli();
+  pwmClockShift = clockShift;
+  #if defined(__AVR_ATmega328P__)
+    if (isPwmActive()) {
+      OCR1B = scaledDutyCycle(fanDutyCycleValue);   // double-buffered => takes effect at the next BOTTOM
+    }
+    TIFR1 = _BV(TOV1);
+    while (! (TIFR1 & _BV(TOV1))) { }              // mode 8: set at BOTTOM
+    ICR1 = TIMER1_COUNT_TO >> clockShift;
 
   #elif defined(__AVR_ATtiny85__)
-    OCR1A = value;
+    TIFR = _BV(TOV1);
+    while (! (TIFR & _BV(TOV1))) { }               // set when the counter wraps after matching OCR1C
+    OCR1C = TIMER1_COUNT_TO >> clockShift;
+    setFanDutyCycle(fanDutyCycleValue);
   #endif
+  SREG = oldSREG;
 }
 
 pwm_duty_t getFanDutyCycle() {
@@ -276,7 +334,5 @@ void invertStatusLED() {
 }
 
 void showPauseBlip() {
-  setStatusLED(HIGH);
-  delay(INTERVAL_PAUSE_BLIP_ON_DURATION_MS);
-  setStatusLED(LOW);
+  playLedPattern(LED_PATTERN_BLIP);   // played back by the watchdog ISR => the CPU can go back to sleep
 }
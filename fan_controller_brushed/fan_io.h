@@ -6,7 +6,9 @@
   
   #if defined(__AVR_ATmega328P__)
     #define VERBOSE
+    // #define ISR_STATS      // ISR duration statistics --> see isr_stats.h
   #endif
+  // #define MEM_STATS        // stack / SRAM high-water marks --> see mem_stats.h
 
   typedef uint16_t millivolt_t;
   
@@ -20,6 +22,7 @@
     const pin_t FAN_PWM_OUT_PIN = 10;             // PB2 - OC1B PWM signal !! DO NOT CHANGE PIN !! (PWM configuration is specific to Timer 1)
     const pin_t STATUS_LED_OUT_PIN = 5;           // PD5 - digital out; is on when fan is of, blinks during transitioning 
     const pin_t SLEEP_LED_OUT_PIN = 4;            // PD4 - digital out; on while MCU is in sleep mode 
+    const pin_t FAN_POWER_ON_OUT_PIN = 3;         // PD3 - Fan power: MOSFET on/off (some fans don't stop at PWM duty cycle = 0%)
   
   #elif defined(__AVR_ATtiny85__)
     const pin_t MODE_SWITCH_IN_PIN = PB2;         // digital: LOW --> CONTINOUS, HIGH --> INTERVAL (HIGH --> port configured as pull-up)
@@ -27,8 +30,8 @@
     const pin_t INTENSITY_SWITCH_IN_PIN_2 = PB3;  // digital: PB4==HIGH && PB3==LOW   --> HIGH INTENSITY
                                                   //          PD4==HIGH && PD3==HIGH  --> MEDIUM INTENSITY
     
-    const pin_t FAN_POWER_ON_OUT_PIN = PB5;       // Fan power: MOSFET on/off (some fans don't stop at PWM duty cycle = 0%)
-    const pin_t FAN_PWM_OUT_PIN = PB1;            // PWM signal @ 25 kHz
+    const pin_t FAN_POWER_ON_OUT_PIN = PB5;       // Fan power: MOSFET on/off (some fans don't stop at PWM duty cycle = 0%); requires fuse RSTDISBL
+    const pin_t FAN_PWM_OUT_PIN = PB1;            // PWM signal (see TIMER1_COUNT_TO)
     const pin_t STATUS_LED_OUT_PIN = PB0;         // digital out; blinks shortly in long intervals when fan is in interval mode
   #endif 
 
@@ -40,18 +43,20 @@
   // FIXED VALUES -- DO NOT CHANGE (unless you know what you're doing)
 
 //
-// PWM / Timer1 scaling to 25 kHz
+// PWM / Timer1 scaling (ATmega328P: 25 kHz)
 //
+// The PWM drives the motor of a brushed fan directly: a low PWM frequency would let the motor current follow every
+// pulse (audible, torque ripple) --> no low-frequency mode as for 2- or 3-pin brushless fans (see fan_controller_brushless)
 #if defined(__AVR_ATmega328P__)
   const uint8_t TIMER1_PRESCALER = 1;      // divide by 1
   const uint16_t TIMER1_COUNT_TO = 320;    // count to this value (Timer 1 is 16 bit)
 
 #elif defined(__AVR_ATtiny85__)
     #if (F_CPU == 1000000UL)
-      // PWM frequency = 1 MHz / 1 / 40 = 25 kHz 
+      // PWM frequency = 1 MHz / 1 / (160 + 1) = 6.2 kHz
       const uint8_t TIMER1_PRESCALER = 1;     // divide by 1
-      const uint8_t TIMER1_COUNT_TO = 160;     // count to 40
-    #elif #if (F_CPU == 128000UL)
+      const uint8_t TIMER1_COUNT_TO = 160;     // count to 160
+    #elif (F_CPU == 128000UL)
       // PWM frequency = 128 kHz / 1 / 5 = 25.6 kHz 
       const uint8_t TIMER1_PRESCALER = 1;     // divide by 1
       const uint8_t TIMER1_COUNT_TO = 5;      // count to 5
@@ -74,11 +79,27 @@
     const pwm_duty_t ANALOG_OUT_MAX = TIMER1_COUNT_TO;   // PWM control
   #endif
 
-  const pwm_duty_t FAN_OUT_LOW_THRESHOLD = (uint32_t) ANALOG_OUT_MAX * FAN_LOW_THRESHOLD_VOLTAGE /  FAN_MAX_VOLTAGE;
+  // Duty value that applies (at least) the given voltage to the fan: the PWM switches the fan supply => linear
+  constexpr pwm_duty_t fanDutyValueFor(millivolt_t voltage) {
+    return ((uint32_t) ANALOG_OUT_MAX * voltage + FAN_MAX_VOLTAGE - 1) / FAN_MAX_VOLTAGE;
+  }
+
+  const pwm_duty_t FAN_OUT_LOW_THRESHOLD = fanDutyValueFor(FAN_LOW_THRESHOLD_VOLTAGE);
+
+  //
+  // CPU CLOCK SCALING (see low_power.h)
+  //
+  // While the MCU sleeps in IDLE with PWM active, the CPU clock and Timer1 TOP are both divided by 2^CPU_CLOCK_SLOW_SHIFT:
+  // the PWM frequency is kept, the duty resolution drops to TIMER1_COUNT_TO >> CPU_CLOCK_SLOW_SHIFT steps.
+  const uint8_t PWM_MIN_RESOLUTION = 40;    // lowest acceptable Timer1 TOP while the clock is scaled down
+
+  constexpr uint8_t cpuClockShiftFor(uint16_t top) {
+    return top >= 2 * PWM_MIN_RESOLUTION ? 1 + cpuClockShiftFor(top / 2) : 0;
+  }
+  const uint8_t CPU_CLOCK_SLOW_SHIFT = cpuClockShiftFor(TIMER1_COUNT_TO);
 
   // Interfaces:
-  const time16_ms_t INTERVAL_PAUSE_BLIP_OFF_DURATION_S = 5;      // [s] LED blips during pause: HIGH state
-  const time16_ms_t INTERVAL_PAUSE_BLIP_ON_DURATION_MS = 200;    // [ms] LED LOW state
+  const time16_ms_t INTERVAL_PAUSE_BLIP_OFF_DURATION_S = 5;      // [s] LED blips during pause (LED_PATTERN_BLIP): LOW state
 
   //
   // INPUTS
@@ -104,6 +125,7 @@
   void configInt0Interrupt();
   void configPinChangeInterrupts();
   void configPWM1();
+  void scalePWM1(uint8_t clockShift);  // adapts Timer1 TOP and duty to a CPU clock divided by 2^clockShift
   
   // Returns true if value changed
   bool updateFanModeFromInputPins();
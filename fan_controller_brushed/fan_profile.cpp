@@ -0,0 +1,58 @@
+#include "fan_profile.h"
+
+millivolt_t fanProfileVoltage(uint8_t point) {
+  return pgm_read_word(& FAN_PROFILE[point].voltage);
+}
+
+permille_t profileAirflow(uint8_t point) {
+  return pgm_read_word(& FAN_PROFILE[point].airflow);
+}
+
+milliwatt_t profilePower(uint8_t point) {
+  return pgm_read_word(& FAN_PROFILE[point].power);
+}
+
+// Index of the segment [point, point + 1] that contains the voltage
+uint8_t profileSegment(millivolt_t voltage) {
+  uint8_t point = 0;
+  while (point < FAN_PROFILE_POINTS - 2 && voltage > fanProfileVoltage(point + 1)) {
+    point++;
+  }
+  return point;
+}
+
+uint16_t interpolate(millivolt_t voltage, uint8_t point, uint16_t y0, uint16_t y1) {
+  millivolt_t v0 = fanProfileVoltage(point);
+  millivolt_t v1 = fanProfileVoltage(point + 1);
+  voltage = constrain(voltage, v0, v1);
+  return y0 + ((int32_t) y1 - y0) * (voltage - v0) / (v1 - v0);
+}
+
+permille_t fanAirflow(millivolt_t voltage) {
+  uint8_t point = profileSegment(voltage);
+  return interpolate(voltage, point, profileAirflow(point), profileAirflow(point + 1));
+}
+
+milliwatt_t fanPower(millivolt_t voltage) {
+  uint8_t point = profileSegment(voltage);
+  return interpolate(voltage, point, profilePower(point), profilePower(point + 1));
+}
+
+millivolt_t fanVoltageForAirflow(permille_t airflow) {
+  uint8_t point = 0;
+  while (point < FAN_PROFILE_POINTS - 2 && airflow > profileAirflow(point + 1)) {
+    point++;
+  }
+  permille_t a0 = profileAirflow(point);
+  permille_t a1 = profileAirflow(point + 1);
+  millivolt_t v0 = fanProfileVoltage(point);
+  millivolt_t v1 = fanProfileVoltage(point + 1);
+  if (airflow <= a0) {
+    return v0;
+  }
+  if (airflow >= a1) {
+    return v1;
+  }
+  // round up => the airflow at the returned voltage is not below the requested one
+  return v0 + ((uint32_t) (v1 - v0) * (airflow - a0) + (a1 - a0 - 1)) / (a1 - a0);
+}
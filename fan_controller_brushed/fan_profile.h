@@ -0,0 +1,43 @@
+#ifndef FAN_PROFILE_H_INCLUDED
+  #define FAN_PROFILE_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <avr/pgmspace.h>
+  #include "io_util.h"
+  #include "fan_io.h"
+
+  //
+  // Fan characteristics over the supply voltage, used by the iso-airflow interval mode (see fan_control.h).
+  //
+  // Replace the values by measurements of the actual fan (airflow e.g. with an anemometer, power = voltage x current).
+  // Defaults: cube law for a 13 V fan with 1.8 W at full speed (airflow ~ speed ~ voltage, power ~ speed^3) plus
+  // 100 mW for the fan electronics.
+  //
+  typedef uint16_t permille_t;
+  typedef uint16_t milliwatt_t;
+
+  typedef struct {
+    millivolt_t voltage;   // [mV] ascending; first point: FAN_LOW_THRESHOLD_VOLTAGE, last point: FAN_MAX_VOLTAGE
+    permille_t airflow;    // [‰] of the airflow at FAN_MAX_VOLTAGE
+    milliwatt_t power;     // [mW]
+  } FanProfilePoint;
+
+  const FanProfilePoint FAN_PROFILE[] PROGMEM = {
+    {  4200,  323,  161 },
+    {  6000,  462,  277 },
+    {  8000,  615,  520 },
+    { 10000,  769,  919 },
+    { 13000, 1000, 1900 }
+  };
+  const uint8_t FAN_PROFILE_POINTS = sizeof(FAN_PROFILE) / sizeof(FAN_PROFILE[0]);
+
+  millivolt_t fanProfileVoltage(uint8_t point);
+
+  // Linear interpolation between the profile points; voltages outside the profile are clamped
+  permille_t fanAirflow(millivolt_t voltage);
+  milliwatt_t fanPower(millivolt_t voltage);
+
+  // Lowest voltage that delivers at least the given airflow; never below the stall threshold (first point)
+  millivolt_t fanVoltageForAirflow(permille_t airflow);
+
+#endif
@@ -16,17 +16,13 @@
   typedef int16_t duration16_s_t;
   typedef int32_t duration32_s_t;
   
-  const duration16_ms_t SWITCH_DEBOUNCE_WAIT_MS = 10;
+  const duration16_ms_t SWITCH_DEBOUNCE_WAIT_MS = 10;  // busy wait, also used inside ISRs --> must not depend on Timer0
   
   void configInput(pin_t pin);
   
   void configInputWithPullup(pin_t pin);
   
   void configOutput(pin_t pin);
-
-  void turnOnLED(pin_t pin, duration32_ms_t duration);
-    
-  void flashLED(pin_t pin, uint8_t times);
   
   void debounceSwitch();
   
@@ -0,0 +1,131 @@
+#include <util/atomic.h>
+#include <avr/power.h>
+#include "isr_stats.h"
+#include "wdt_time.h"
+#include "trace.h"
+
+#ifdef ISR_STATS
+
+IsrStats isrStats[ISR_STATS_VECTORS];
+volatile uint8_t isrStatsOverflows = 0;   // high byte of the tick counter
+time32_s_t isrStatsNextReportTime = ISR_STATS_REPORT_PERIOD_S;
+uint8_t isrStatsNesting = 0;
+
+void configIsrStats() {
+  power_timer2_enable();
+  TCCR2A = 0;                                  // normal mode: count 0..255, 0..255, etc.
+  TCCR2B = _BV(CS21) | _BV(CS20);              // prescale factor = 32 (ISR_STATS_PRESCALER)
+  TCNT2 = 0;
+  TIMSK2 = _BV(TOIE2);                         // Enable overflow interrupt
+  configOutput(ISR_STATS_DEBUG_PIN);
+
+  for (uint8_t v = 0; v < ISR_STATS_VECTORS; v++) {
+    isrStats[v].min = UINT16_MAX;
+  }
+}
+
+ISR (TIMER2_OVF_vect) {
+  isrStatsOverflows++;
+}
+
+// Same approach as micros() in the Arduino core: account for an overflow that is pending because interrupts are disabled
+inline isr_ticks_t isrStatsTicks() {
+  uint8_t count = TCNT2;
+  uint8_t high = isrStatsOverflows;
+  if (bit_is_set(TIFR2, TOV2) && count < 255) {
+    high++;
+  }
+  return ((isr_ticks_t) high << 8) | count;
+}
+
+isr_ticks_t isrStatsEnter() {
+  isr_ticks_t entry;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (bit_is_set(TIFR2, TOV2)) {
+      // overflow left pending by a busy wait with interrupts disabled (e.g. the debounce): count it here as the overflow
+      // ISR would, so the section has the full range of one overflow
+      TIFR2 = _BV(TOV2);
+      isrStatsOverflows++;
+    }
+    entry = isrStatsTicks();
+    if (isrStatsNesting++ == 0) {
+      PORTB |= ISR_STATS_DEBUG_BIT;   // ISR_STATS_DEBUG_PIN HIGH (direct port access: digitalWrite() would distort the measurement)
+    }
+  }
+  return entry;
+}
+
+void isrStatsExit(IsrStatsVector vector, isr_ticks_t entry) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    isr_ticks_t duration = isrStatsTicks() - entry;
+    if (--isrStatsNesting == 0) {
+      PORTB &= ~ISR_STATS_DEBUG_BIT;  // ISR_STATS_DEBUG_PIN LOW
+    }
+    // more than 255 ticks with an overflow pending: further overflows may have been missed meanwhile
+    bool saturated = bit_is_set(TIFR2, TOV2) && duration > 255;
+    
+    IsrStats* s = & isrStats[vector];
+    uint8_t bucket = 0;
+    if (saturated) {
+      s->max = ISR_STATS_SATURATED;
+      bucket = ISR_STATS_HISTOGRAM_BUCKETS - 1;
+    } else {
+      if (s->count < UINT16_MAX) {
+        s->count++;
+        s->sum += duration;
+      }
+      if (duration < s->min) s->min = duration;
+      if (duration > s->max) s->max = duration;
+      
+      while (duration > 0 && bucket < ISR_STATS_HISTOGRAM_BUCKETS - 1) {
+        duration >>= 1;
+        bucket++;
+      }
+    }
+    if (s->histogram[bucket] < UINT16_MAX) {
+      s->histogram[bucket]++;
+    }
+  }
+}
+
+IsrStats getIsrStats(IsrStatsVector vector) {
+  IsrStats copy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    copy = isrStats[vector];
+  }
+  return copy;
+}
+
+void reportIsrStats() {
+  time32_s_t now = wdtTime_s();
+  if (now < isrStatsNextReportTime) {
+    return;
+  }
+  isrStatsNextReportTime = now + ISR_STATS_REPORT_PERIOD_S;
+  
+  for (uint8_t v = 0; v < ISR_STATS_VECTORS; v++) {
+    IsrStats s = getIsrStats((IsrStatsVector) v);
+    if (s.count == 0) {
+      continue;
+    }
+    TRACE(TRACE_ISR_COUNT, v, s.count);
+    TRACE(TRACE_ISR_MIN, v, s.min);
+    TRACE(TRACE_ISR_MAX, v, s.max);
+    TRACE(TRACE_ISR_AVG, v, s.sum / s.count);
+    for (uint8_t b = 0; b < ISR_STATS_HISTOGRAM_BUCKETS; b++) {
+      if (s.histogram[b] > 0) {
+        TRACE(TRACE_ISR_HISTOGRAM, (v << 4) | b, s.histogram[b]);
+      }
+    }
+  }
+}
+
+#else
+
+void configIsrStats() { }
+isr_ticks_t isrStatsEnter() { return 0; }
+void isrStatsExit(IsrStatsVector vector, isr_ticks_t entry) { }
+IsrStats getIsrStats(IsrStatsVector vector) { IsrStats none = {}; return none; }
+void reportIsrStats() { }
+
+#endif
@@ -0,0 +1,80 @@
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include "led_pattern.h"
+#include "fan_io.h"
+#include "wdt_time.h"
+
+typedef struct {
+  uint16_t bits;      // LSB first: 1 = LED on
+  uint8_t length;     // [steps]
+  uint8_t timeout;    // WDTO_*: duration of one step
+  bool repeat;
+} LedPattern;
+
+// !! Order must match LedPatternId !!
+const LedPattern LED_PATTERNS_P[LED_PATTERNS] PROGMEM = {
+  { 0b010101,      6, WDTO_120MS, false },   // BOOT:             128 ms on / 128 ms off
+  { 0b111,         3, WDTO_60MS,  false },   // BLIP:             192 ms on
+  { 0b011011011,   9, WDTO_250MS, false },   // FAULT:            3 x 512 ms on
+  { 0b01,          2, WDTO_120MS, true  }    // SPEED_TRANSITION: 128 ms on / 128 ms off
+};
+
+LedPattern ledPattern;                  // RAM copy of the pattern playing
+volatile bool ledPatternPlaying = false;
+uint8_t ledPatternStep;
+time16_ms_t ledPatternStepElapsed;      // [ms] time spent in the current step
+
+inline time16_ms_t stepDuration_ms(uint8_t timeout) {
+  return WDT_MIN_PERIOD_MS << timeout;
+}
+
+void showStep() {
+  setStatusLED((ledPattern.bits >> ledPatternStep) & 1);
+}
+
+void playLedPattern(LedPatternId id) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy_P(& ledPattern, & LED_PATTERNS_P[id], sizeof(LedPattern));
+    ledPatternStep = 0;
+    ledPatternStepElapsed = 0;
+    ledPatternPlaying = true;
+    showStep();
+  }
+  wdtPeriodUpdate();   // limit the watchdog period to the pattern's step
+}
+
+void stopLedPattern() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ledPatternPlaying = false;
+    setStatusLED(LOW);
+  }
+}
+
+bool isLedPatternPlaying() {
+  return ledPatternPlaying;
+}
+
+void ledPatternTick(time16_ms_t elapsed) {
+  if (! ledPatternPlaying) {
+    return;
+  }
+  // the watchdog period may be shorter than a step, e.g. at the end of a delay
+  ledPatternStepElapsed += elapsed;
+  time16_ms_t step = stepDuration_ms(ledPattern.timeout);
+  while (ledPatternStepElapsed >= step) {
+    ledPatternStepElapsed -= step;
+    if (++ledPatternStep >= ledPattern.length) {
+      if (! ledPattern.repeat) {
+        stopLedPattern();
+        return;
+      }
+      ledPatternStep = 0;
+    }
+  }
+  showStep();
+}
+
+uint8_t ledPatternTimeout() {
+  return ledPatternPlaying ? ledPattern.timeout : WDTO_8S;
+}
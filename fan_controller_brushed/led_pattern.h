@@ -0,0 +1,32 @@
+#ifndef LED_PATTERN_H_INCLUDED
+  #define LED_PATTERN_H_INCLUDED
+
+  #include <Arduino.h>
+  #include "io_util.h"
+
+  //
+  // Status-LED patterns, played back by the watchdog ISR while the CPU sleeps.
+  //
+  // A pattern is a bit sequence in PROGMEM (LSB first, 1 = LED on); each bit lasts one step of a watchdog period.
+  // While a pattern plays, the watchdog period is limited to the pattern's step (see wdtPeriodFor()).
+  //
+  typedef enum {
+    LED_PATTERN_BOOT,              // 3 flashes
+    LED_PATTERN_BLIP,              // interval pause
+    LED_PATTERN_FAULT,             // 3 long flashes
+    LED_PATTERN_SPEED_TRANSITION,  // repeats until stopped
+    LED_PATTERNS
+  } LedPatternId;
+
+  // ISR-safe; replaces the pattern currently playing
+  void playLedPattern(LedPatternId id);
+  // ISR-safe; turns the LED off
+  void stopLedPattern();
+  bool isLedPatternPlaying();
+
+  // invoked by the watchdog ISR only
+  void ledPatternTick(time16_ms_t elapsed);
+  // WDTO_* of the current step; WDTO_8S if no pattern is playing (=> no limit)
+  uint8_t ledPatternTimeout();
+
+#endif
@@ -2,14 +2,21 @@
 #include <avr/sleep.h>
 #include <avr/power.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "low_power.h"
 #include "wdt_time.h"
 #include "fan_io.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "mem_stats.h"
+
+clock_div_t bootClockPrescaler;   // ATtiny85: the CKDIV8 fuse divides the 8 MHz oscillator down to F_CPU = 1 MHz
 
 #if defined(__AVR_ATmega328P__)
   
   void configLowPower() {
+    bootClockPrescaler = clock_prescale_get();
     ADCSRA &= ~(1 << ADEN);
     power_adc_disable();
     power_spi_disable();
@@ -18,27 +25,131 @@
     #endif
     power_twi_disable();
     
-    // power_timer0_disable(); // cannot disable, required for millis() function
+    // Timer0 is turned off in setup() by disableArduinoTimer0() once the watchdog time base runs
     // power_timer1_disable(); // cannot disable, required for PWM output on Pin 10
     power_timer2_disable(); 
   }
 
+  // Power Reduction Register: modules that keep their clock during sleep
+  const uint8_t SLEEP_PRR_ALL = _BV(PRTWI) | _BV(PRTIM2) | _BV(PRTIM0) | _BV(PRSPI) | _BV(PRTIM1) | _BV(PRUSART0) | _BV(PRADC);
+  const uint8_t SLEEP_PRR_KEEP = _BV(PRTIM1)     // PWM
+    #ifdef ISR_STATS
+      | _BV(PRTIM2)                              // ISR timestamps
+    #endif
+    #ifdef VERBOSE
+      | _BV(PRUSART0)                            // USART would have to be re-initialised after being stopped by PRR
+    #endif
+    ;
+  // Digital input buffers of the unused analog pins PC0..PC5 (PD6/PD7 = AIN0/AIN1 are the intensity inputs)
+  const uint8_t SLEEP_DIDR0 = _BV(ADC5D) | _BV(ADC4D) | _BV(ADC3D) | _BV(ADC2D) | _BV(ADC1D) | _BV(ADC0D);
+
 #elif defined(__AVR_ATtiny85__)
   
   void configLowPower() {
+    bootClockPrescaler = clock_prescale_get();
     power_usi_disable(); 
     
     ADCSRA &= ~_BV(ADEN);   // Disable ADC --> saves 320 µA on ATtiny85
     ACSR   |=  _BV(ACD);
     power_adc_disable();
-    
-    cli();                  // Stop interrupts to ensure the BOD timed sequence executes as required
-    sleep_bod_disable();    // Brown-out disable
-    sei();
+    // Brown-out detection is disabled right before each sleep_cpu() (the BODS bit is cleared by hardware after 3 cycles)
   }
 
+  // Power Reduction Register: modules that keep their clock during sleep
+  const uint8_t SLEEP_PRR_ALL = _BV(PRTIM1) | _BV(PRTIM0) | _BV(PRUSI) | _BV(PRADC);
+  const uint8_t SLEEP_PRR_KEEP = _BV(PRTIM1);   // PWM
+  // Digital input buffers of PB5 (RESET) and of the output-only pins PB0 (AIN0) and PB1 (AIN1); PB2..PB4 need theirs for pin-change interrupts
+  const uint8_t SLEEP_DIDR0 = _BV(ADC0D) | _BV(AIN1D) | _BV(AIN0D);
+
 #endif
 
+//
+// SLEEP RESIDENCY
+//
+
+volatile CpuActivity cpuActivity = CPU_AWAKE;
+volatile SleepResidency residency;
+
+void countResidency(time16_ms_t elapsed) {
+  switch (cpuActivity) {
+    case CPU_IDLE_SLEEP:  residency.idleSleep_ms += elapsed; break;
+    case CPU_POWER_DOWN:  residency.powerDown_ms += elapsed; break;
+    default:              residency.awake_ms += elapsed; break;
+  }
+}
+
+void countWakeup(WakeupCause cause) {
+  if (cpuActivity != CPU_AWAKE) {
+    cpuActivity = CPU_AWAKE;
+    if (residency.wakeups[cause] < UINT16_MAX) {
+      residency.wakeups[cause]++;
+    }
+  }
+}
+
+SleepResidency getSleepResidency() {
+  SleepResidency copy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    copy = *((SleepResidency*) & residency);
+  }
+  return copy;
+}
+
+//
+// PERIPHERAL GATING
+//
+
+uint8_t awakePRR;
+uint8_t awakeACSR;
+uint8_t awakeDIDR0;
+
+// Stops the clock of every module except Timer1 (PWM) and those in SLEEP_PRR_KEEP, turns off the analog comparator and
+// the digital input buffers of unused pins. Pin-change logic is not affected.
+void peripheralsOffForSleep() {
+  awakePRR = PRR;
+  awakeACSR = ACSR;
+  awakeDIDR0 = DIDR0;
+
+  PRR = awakePRR | (SLEEP_PRR_ALL & ~SLEEP_PRR_KEEP);
+  ACSR = awakeACSR & ~_BV(ACIE);  // interrupt must be disabled before the comparator is switched off
+  ACSR |= _BV(ACD);
+  DIDR0 = awakeDIDR0 | SLEEP_DIDR0;
+}
+
+void peripheralsOnAfterSleep() {
+  DIDR0 = awakeDIDR0;
+  ACSR = awakeACSR;
+  PRR = awakePRR;
+}
+
+//
+// CPU CLOCK SCALING
+//
+
+volatile bool cpuClockScaled = false;
+
+// Divides the CPU clock by 2^CPU_CLOCK_SLOW_SHIFT for IDLE sleep; Timer1 TOP follows so that the PWM frequency stays 
+// as it is. Interrupts must be disabled.
+void cpuClockSlow() {
+  if (CPU_CLOCK_SLOW_SHIFT == 0) {
+    return;   // no Timer1 TOP left to divide without losing too much duty resolution
+  }
+  scalePWM1(CPU_CLOCK_SLOW_SHIFT);  // first: waits for the end of the PWM period at the full clock
+  clock_prescale_set((clock_div_t) (bootClockPrescaler + CPU_CLOCK_SLOW_SHIFT));
+  cpuClockScaled = true;
+}
+
+void cpuClockFull() {
+  if (cpuClockScaled) {
+    uint8_t oldSREG = SREG;
+    cli();
+    clock_prescale_set(bootClockPrescaler);
+    scalePWM1(0);
+    cpuClockScaled = false;
+    SREG = oldSREG;
+  }
+}
+
 //
 // FUNCTIONS
 //
@@ -52,13 +163,25 @@ void enterSleep();
  * returns true if interrupted (i.e. cut short) or false, if not interrupted
  */
 bool delayInterruptible_millis(time16_ms_t duration) {
-  delay(duration);
+  // Sleeps in steps of watchdog periods (no Timer0 / delay()); the remainder shorter than WDT_MIN_PERIOD_MS is carried
+  // over to the next call => repeated delays (speed transition cycles) keep their duration on average
+  static int8_t carry_ms = 0;   // > 0: not slept yet, < 0: slept too long (bounded by WDT_MIN_PERIOD_MS)
+  time32_ms_t now = wdtTime_ms();
+  time32_ms_t delayUntil = now + max((int16_t) duration + carry_ms, 0);
+  while (now + WDT_MIN_PERIOD_MS <= delayUntil) {
+    wdtPeriodFor(delayUntil - now);
+    enterSleep();
+    now = wdtTime_ms();
+  }
+  int32_t remainder_ms = (int32_t) (delayUntil - now);
+  carry_ms = constrain(remainder_ms, - (int16_t) WDT_MIN_PERIOD_MS, (int16_t) WDT_MIN_PERIOD_MS);
   return false;
 }
 
 bool delayInterruptible_seconds(time16_s_t duration) { 
   time32_s_t now = wdtTime_s();
   time32_s_t delayUntil = now + duration;
+  wdtPeriodFor(WDT_MAX_PERIOD_MS);
   while (now < delayUntil) {
     enterSleep();
     // invertStatusLED();  // use to debug watchdog / interrupt problems ///////////
@@ -82,6 +205,7 @@ bool delayInterruptible_seconds(time16_s_t duration) {
 }
 
 void waitForUserInput() {
+  wdtPeriodFor(WDT_MAX_PERIOD_MS);
   enterSleep(); // wait for watchdog interrupt or user interrupt
 }
 
@@ -91,19 +215,40 @@ void enterSleep() {
     digitalWrite(SLEEP_LED_OUT_PIN, HIGH);
   #endif
   
+  reportIsrStats();
+  reportMemStats();
+  traceDrain();  // the CPU would be idle anyway => send buffered trace records now
+  wdtHeartbeat();
+  
   cli();
   
   if (isPwmActive()) {
     // We require Timer2 to stay active for PWM --> IDLE
     set_sleep_mode(SLEEP_MODE_IDLE);
+    cpuActivity = CPU_IDLE_SLEEP;
+    if (traceIdle()) {
+      cpuClockSlow();   // not while the USART is still sending: its baud rate would change
+    }
+  } else if (! traceIdle()) {
+    // USART must keep its clock until the trace records have been sent --> IDLE
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cpuActivity = CPU_IDLE_SLEEP;
   } else {
     set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cpuActivity = CPU_POWER_DOWN;
   }
   
+  peripheralsOffForSleep();
   sleep_enable();
+  #if defined(BODS)
+    sleep_bod_disable();  // timed sequence: sleep_cpu() must follow within 3 cycles
+  #endif
   sei();
   sleep_cpu();      // Controller waits for interrupt here
   sleep_disable();
+  cpuClockFull();   // no-op if a pin-change ISR has already restored the clock
+  peripheralsOnAfterSleep();
+  countWakeup(WAKEUP_TIMER);  // no-op if the ISR of the watchdog or of a pin change has already counted this wake-up
   
 //  if (sleeplessMillis() - start < 50) {
 //    delay(50); // wait so we have a flashing LED on rapid short sleeps
@@ -4,8 +4,30 @@
   #include <Arduino.h>
   #include "io_util.h"
 
+  typedef enum {CPU_AWAKE, CPU_IDLE_SLEEP, CPU_POWER_DOWN} CpuActivity;
+  typedef enum {WAKEUP_WDT, WAKEUP_PIN_CHANGE, WAKEUP_TIMER, WAKEUP_CAUSES} WakeupCause;  // WAKEUP_TIMER: any other interrupt
+  
+  // Sampled at each watchdog tick: the tick's duration is attributed to what the CPU was doing when the tick fired 
+  typedef struct {
+    time32_ms_t awake_ms;
+    time32_ms_t idleSleep_ms;
+    time32_ms_t powerDown_ms;
+    uint16_t wakeups[WAKEUP_CAUSES];
+  } SleepResidency;
+
   void configLowPower();
   
+  // invoked by interrupt service routines (ISR) only
+  void countResidency(time16_ms_t elapsed);
+  void countWakeup(WakeupCause cause);
+  
+  // Restores F_CPU after IDLE sleep with a scaled-down clock (see CPU_CLOCK_SLOW_SHIFT); ISR-safe. 
+  // Interrupt service routines that rely on F_CPU (delays, serial output) must call it first.
+  void cpuClockFull();
+  
+  // Returns a consistent copy of the residency counters since boot
+  SleepResidency getSleepResidency();
+  
   bool delayInterruptible_millis(time16_ms_t duration);
   bool delayInterruptible_seconds(time16_s_t duration);
   
@@ -0,0 +1,66 @@
+#include "mem_stats.h"
+#include "wdt_time.h"
+#include "trace.h"
+
+#ifdef MEM_STATS
+
+extern uint8_t _end;      // end of the static data (linker script)
+extern uint8_t __data_start;
+
+volatile uint8_t isrNesting = 0;
+volatile uint8_t isrNestingMax = 0;
+time32_s_t memStatsNextReportTime = MEM_STATS_REPORT_PERIOD_S;
+
+// Runs before the C runtime initialisation, once the stack pointer has been set up (.init2); nothing is on the stack yet
+void paintStack() __attribute__ ((naked, used, section (".init3")));
+void paintStack() {
+  uint8_t* p = & _end;
+  while (p < (uint8_t*) SP) {
+    *p++ = MEM_STATS_PAINT;
+  }
+}
+
+void memStatsIsrEnter() {
+  if (++isrNesting > isrNestingMax) {
+    isrNestingMax = isrNesting;
+  }
+}
+
+void memStatsIsrExit() {
+  isrNesting--;
+}
+
+MemStats getMemStats() {
+  MemStats stats;
+  stats.staticBytes = & _end - & __data_start;
+
+  const uint8_t* p = & _end;
+  while (p <= (uint8_t*) RAMEND && *p == MEM_STATS_PAINT) {
+    p++;
+  }
+  stats.minFreeStack = p - & _end;
+  stats.maxIsrNesting = isrNestingMax;
+  return stats;
+}
+
+void reportMemStats() {
+  time32_s_t now = wdtTime_s();
+  if (now < memStatsNextReportTime) {
+    return;
+  }
+  memStatsNextReportTime = now + MEM_STATS_REPORT_PERIOD_S;
+
+  MemStats s = getMemStats();
+  TRACE(TRACE_MEM_STATIC, 0, s.staticBytes);
+  TRACE(TRACE_MEM_FREE_STACK, 0, s.minFreeStack);
+  TRACE(TRACE_MEM_ISR_NESTING, 0, s.maxIsrNesting);
+}
+
+#else
+
+void memStatsIsrEnter() { }
+void memStatsIsrExit() { }
+MemStats getMemStats() { return MemStats { 0, 0, 0 }; }
+void reportMemStats() { }
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MEM_STATS_H_INCLUDED
+  #define MEM_STATS_H_INCLUDED
+
+  #include <Arduino.h>
+  #include "io_util.h"
+  #include "fan_io.h"
+
+  //
+  // Optional SRAM instrumentation (#define MEM_STATS --> see fan_io.h).
+  //
+  // At boot, the free SRAM between the end of the static data (.data, .bss, .noinit) and the stack pointer is painted
+  // with MEM_STATS_PAINT. Bytes the stack has ever grown into are overwritten => scanning for the first painted byte
+  // yields the minimum free stack observed since boot. Instrumented ISRs record their worst nesting depth.
+  //
+  // Static usage per module: run tools/ram_usage.py on the ELF file of the build.
+  //
+
+  const uint8_t MEM_STATS_PAINT = 0xC5;
+  const time16_s_t MEM_STATS_REPORT_PERIOD_S = 60;     // [s] statistics are sent as trace records this often
+
+  typedef struct {
+    uint16_t staticBytes;     // .data + .bss + .noinit
+    uint16_t minFreeStack;    // [bytes] never touched by the stack since boot
+    uint8_t maxIsrNesting;
+  } MemStats;
+
+  #ifdef MEM_STATS
+    #define MEM_STATS_ISR_ENTER() memStatsIsrEnter()
+    #define MEM_STATS_ISR_EXIT() memStatsIsrExit()
+  #else
+    #define MEM_STATS_ISR_ENTER()
+    #define MEM_STATS_ISR_EXIT()
+  #endif
+
+  void memStatsIsrEnter();
+  void memStatsIsrExit();
+
+  // Scans the painted area => takes a few CPU cycles per free byte
+  MemStats getMemStats();
+
+  // Writes the statistics as trace records once per MEM_STATS_REPORT_PERIOD_S
+  void reportMemStats();
+
+#endif
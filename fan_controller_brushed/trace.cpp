@@ -0,0 +1,79 @@
+#include <util/atomic.h>
+#include "trace.h"
+#include "wdt_time.h"
+
+#ifdef VERBOSE
+
+typedef struct {
+  uint16_t time_ms;   // [ms] wraps after 65.5 s
+  uint8_t  id;        // TraceId
+  uint8_t  state;
+  uint16_t value;
+} TraceRecord;
+
+TraceRecord traceBuffer[TRACE_BUFFER_SIZE];
+volatile uint8_t traceHead = 0;     // next slot to write (ISR and main program)
+volatile uint8_t traceTail = 0;     // next slot to drain (main program only)
+volatile uint16_t traceDropped = 0;
+bool traceTransmitting = false;
+
+inline uint8_t traceNext(uint8_t index) {
+  return (index + 1) & (TRACE_BUFFER_SIZE - 1);
+}
+
+inline uint8_t traceFree() {
+  return (traceTail - traceHead - 1) & (TRACE_BUFFER_SIZE - 1);
+}
+
+inline void traceWrite(uint16_t time, uint8_t id, uint8_t state, uint16_t value) {
+  TraceRecord* r = & traceBuffer[traceHead];
+  r->time_ms = time;
+  r->id = id;
+  r->state = state;
+  r->value = value;
+  traceHead = traceNext(traceHead);
+}
+
+void traceRecord(uint8_t id, uint8_t state, uint16_t value) {
+  uint16_t time = (uint16_t) wdtTime_ms();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (traceDropped > 0 && traceFree() >= 2) {
+      traceWrite(time, TRACE_OVERFLOW, 0, traceDropped);
+      traceDropped = 0;
+    }
+    if (traceDropped == 0 && traceFree() >= 1) {
+      traceWrite(time, id, state, value);
+    } else if (traceDropped < UINT16_MAX) {
+      traceDropped++;
+    }
+  }
+}
+
+void traceDrain() {
+  // the slot at traceTail is not touched by traceRecord() until traceTail has advanced => no locking required
+  while (traceTail != traceHead && Serial.availableForWrite() > (int) sizeof(TraceRecord)) {
+    Serial.write(TRACE_SYNC);
+    Serial.write((const uint8_t*) & traceBuffer[traceTail], sizeof(TraceRecord));
+    traceTail = traceNext(traceTail);
+    traceTransmitting = true;
+  }
+}
+
+bool traceIdle() {
+  if (traceTail != traceHead) {
+    return false;
+  }
+  // TXC0 is set by the hardware once the last byte has left the shift register
+  if (traceTransmitting && Serial.availableForWrite() == SERIAL_TX_BUFFER_SIZE - 1 && bit_is_set(UCSR0A, TXC0)) {
+    traceTransmitting = false;
+  }
+  return ! traceTransmitting;
+}
+
+#else
+
+void traceRecord(uint8_t id, uint8_t state, uint16_t value) { }
+void traceDrain() { }
+bool traceIdle() { return true; }
+
+#endif
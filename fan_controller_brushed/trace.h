@@ -0,0 +1,59 @@
+#ifndef TRACE_H_INCLUDED
+  #define TRACE_H_INCLUDED
+
+  #include <Arduino.h> 
+  #include "io_util.h"
+  #include "fan_io.h"
+
+  //
+  // Binary trace of controller events (VERBOSE builds only).
+  //
+  // Records are written to a RAM ring buffer in a few cycles (also from ISRs) and are drained to the interrupt-driven 
+  // UART only right before the MCU goes to sleep. Decode the serial stream with tools/trace_decode.py --variant brushed
+  //
+  // Frame on the wire: TRACE_SYNC, time_ms (uint16 LE), id, state, value (uint16 LE)
+  // time_ms is the watchdog time => its resolution is the current watchdog period
+  //
+  
+  // !! Numeric values must match tools/trace_decode.py !!
+  typedef enum {
+    TRACE_NONE,
+    TRACE_BOOT,            // state: reset flags (MCUSR), value: F_CPU / 1000 [kHz]
+    TRACE_MODE_READ,       // value: FanMode
+    TRACE_INTENSITY_READ,  // value: FanIntensity
+    TRACE_TRANSITION,      // state: new FanState, value: (previous FanState << 8) | Event
+    TRACE_SPEED_UP,        // state: FanState, value: duty
+    TRACE_SLOW_DOWN,       // state: FanState, value: duty
+    TRACE_DUTY,            // value: raw duty value written to the timer
+    TRACE_OVERFLOW,        // value: number of records dropped because the buffer was full
+    TRACE_ISR_COUNT,       // state: IsrStatsVector, value: number of measured executions
+    TRACE_ISR_MIN,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_MAX,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_AVG,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_HISTOGRAM,   // state: (IsrStatsVector << 4) | bucket, value: count
+    TRACE_MEM_STATIC,      // value: .data + .bss + .noinit [bytes]
+    TRACE_MEM_FREE_STACK,  // value: minimum free stack since boot [bytes]
+    TRACE_MEM_ISR_NESTING, // value: worst ISR nesting depth
+    TRACE_DWELL_HELD,      // state: Event held back, value: [s] until the dwell time (FAN_MIN_..._DURATION) is over
+    TRACE_CYCLE_SUPPRESSED // state: FanState, value: start/stop cycles suppressed since boot
+  } TraceId;
+  
+  const uint8_t TRACE_SYNC = 0xA5;
+  const uint8_t TRACE_BUFFER_SIZE = 32;  // [records] must be a power of 2
+
+  #ifdef VERBOSE
+    #define TRACE(id, state, value) traceRecord((id), (state), (value))
+  #else
+    #define TRACE(id, state, value)
+  #endif
+
+  // ISR-safe
+  void traceRecord(uint8_t id, uint8_t state, uint16_t value);
+  
+  // Writes as many buffered records to the UART as fit its transmit buffer without blocking
+  void traceDrain();
+
+  // Returns true if no records are buffered and the UART has finished transmitting (=> USART may stop in sleep)
+  bool traceIdle();
+
+#endif
@@ -0,0 +1,62 @@
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include "warm_restart.h"
+
+const uint16_t RETAINED_MAGIC = 0xFA27;
+
+typedef struct {
+  uint16_t magic;
+  FanControlSnapshot fanControl;
+  uint8_t crc;
+} RetainedState;
+
+RetainedState retained __attribute__ ((section (".noinit")));
+uint8_t resetFlags __attribute__ ((section (".noinit")));
+
+// Runs before the C runtime initialisation: saves and clears the reset flags and stops the watchdog, which stays
+// enabled with its shortest timeout after a watchdog reset
+void saveResetFlags() __attribute__ ((naked, used, section (".init3")));
+void saveResetFlags() {
+  resetFlags = MCUSR;
+  if (resetFlags == 0) {
+    // optiboot has cleared MCUSR already and hands it over in r2
+    asm volatile ("mov %0, r2" : "=r" (resetFlags));
+  }
+  MCUSR = 0;
+  wdt_disable();
+}
+
+uint8_t getResetFlags() {
+  return resetFlags;
+}
+
+bool isWarmRestart() {
+  return (resetFlags & (_BV(WDRF) | _BV(BORF))) && ! (resetFlags & _BV(PORF));
+}
+
+uint8_t retainedCrc() {
+  uint8_t crc = 0;
+  const uint8_t* bytes = (const uint8_t*) & retained;
+  for (uint8_t i = 0; i < offsetof(RetainedState, crc); i++) {
+    crc = _crc8_ccitt_update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+void retainFanControl(const FanControlSnapshot* snapshot) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    retained.magic = RETAINED_MAGIC;
+    retained.fanControl = *snapshot;
+    retained.crc = retainedCrc();
+  }
+}
+
+bool restoreFanControl(FanControlSnapshot* snapshot) {
+  if (! isWarmRestart() || retained.magic != RETAINED_MAGIC || retained.crc != retainedCrc()) {
+    return false;
+  }
+  *snapshot = retained.fanControl;
+  return true;
+}
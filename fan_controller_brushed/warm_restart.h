@@ -0,0 +1,34 @@
+#ifndef WARM_RESTART_H_INCLUDED
+  #define WARM_RESTART_H_INCLUDED
+
+  #include <Arduino.h>
+  #include "io_util.h"
+
+  //
+  // Controller state retained in .noinit RAM across watchdog and brown-out resets.
+  //
+  // The snapshot is protected by a magic value and a CRC-8 => after a power-on, an external reset or a brown-out that
+  // corrupted the RAM, the controller starts cold from FAN_OFF.
+  // The watchdog time (wdt_time.h) is retained as well, so that the interval phase times stay valid.
+  //
+  typedef struct {
+    uint8_t fanState;                  // FanState
+    pwm_duty_t dutyValue;
+    pwm_duty_t targetDutyValue;
+    time32_s_t intervalPhaseBeginTime; // [s]
+    time32_s_t intervalPauseDuration;  // [s]
+  } FanControlSnapshot;
+
+  // MCUSR at reset (PORF, EXTRF, BORF, WDRF); WDRF => the watchdog has recovered from a hang (see wdt_time.h)
+  uint8_t getResetFlags();
+
+  // true after a watchdog or brown-out reset => retained RAM may be used
+  bool isWarmRestart();
+
+  // ISR-safe
+  void retainFanControl(const FanControlSnapshot* snapshot);
+
+  // Returns true and fills in the snapshot if a warm restart found a valid one
+  bool restoreFanControl(FanControlSnapshot* snapshot);
+
+#endif
@@ -1,49 +1,120 @@
 #include <avr/wdt.h>
 #include <avr/power.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "wdt_time.h"
+#include "isr_stats.h"
+#include "low_power.h"
+#include "led_pattern.h"
+#include "warm_restart.h"
+#include "mem_stats.h"
 
 
 typedef uint8_t watchdog_timeout_t;
   
-const watchdog_timeout_t WATCHDOG_TIMEOUT = WDTO_1S;  // see wdt.h
-const time32_s_t WATCHDOG_TIMEOUT_S = 1;              // [s], depends on previous constant
+const watchdog_timeout_t WATCHDOG_MIN_TIMEOUT = WDTO_15MS;  // see wdt.h
+const watchdog_timeout_t WATCHDOG_MAX_TIMEOUT = WDTO_1S;    // see wdt.h
 
-volatile time32_s_t  time_s = 0;
+volatile watchdog_timeout_t watchdogTimeout = WATCHDOG_MAX_TIMEOUT;
+volatile watchdog_timeout_t requestedTimeout = WATCHDOG_MAX_TIMEOUT;   // set by wdtPeriodFor()
+// retained across warm restarts; timeCheck_ms == ~time_ms unless the RAM content has been lost
+volatile time32_ms_t  time_ms __attribute__ ((section (".noinit")));
+volatile time32_ms_t  timeCheck_ms __attribute__ ((section (".noinit")));
+volatile time16_ms_t  sinceHeartbeat_ms = 0;
+volatile bool atWatchdogTick = false;   // the MCU has not slept since the last watchdog interrupt
 
 
-void configWatchdogTime() {   
+// WDTO_15MS .. WDTO_1S are 0 .. 6 => the period doubles with each step
+inline time16_ms_t watchdogPeriod_ms(watchdog_timeout_t timeout) {
+  return WDT_MIN_PERIOD_MS << timeout;
+}
+
+void watchdogTimeoutInterrupt(watchdog_timeout_t timeout) {
+  uint8_t oldSREG = SREG;
   cli();                  // Stop interrupts
   // Setup a watchdog to wake MCU after the given timeout:
-  wdt_enable(WATCHDOG_TIMEOUT); 
+  wdt_enable(timeout); 
   _WD_CONTROL_REG |= _BV(WDIE);
+  watchdogTimeout = timeout;
+  SREG = oldSREG;
+}
+
+void configWatchdogTime() {   
+  if (! isWarmRestart() || timeCheck_ms != ~time_ms) {
+    time_ms = 0;
+    timeCheck_ms = ~ (time32_ms_t) 0;
+  }
+  watchdogTimeoutInterrupt(WATCHDOG_MAX_TIMEOUT);
   
   #if defined(__AVR_ATtiny85__)
     MCUSR &= ~_BV(WDRF); // see comment in ATtiny85 Datasheet, p.46, Note under "Bit 3 – WDE: Watchdog Enable" 
   #endif
+}
 
-  sei();
+void wdtPeriodFor(time16_ms_t duration) {
+  watchdog_timeout_t timeout = WATCHDOG_MIN_TIMEOUT;
+  while (timeout < WATCHDOG_MAX_TIMEOUT && watchdogPeriod_ms(timeout + 1) <= duration) {
+    timeout++;
+  }
+  requestedTimeout = timeout;
+  wdtPeriodUpdate();
+}
+
+void wdtPeriodUpdate() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    watchdog_timeout_t timeout = min(requestedTimeout, ledPatternTimeout());
+    // the restart drops the part of the period that has passed since the last watchdog interrupt; it cannot be measured
+    // after a wake-up by another interrupt => switch only at a watchdog tick, otherwise the ISR switches at the next one
+    if (timeout != watchdogTimeout && atWatchdogTick) {
+      watchdogTimeoutInterrupt(timeout);
+    }
+  }
 }
 
 ISR (WDT_vect) {
-  // wake up MCU
-  _WD_CONTROL_REG |= _BV(WDIE);  // do not delete this line --> watchdog would reset MCU at next interrupt
-  time_s += WATCHDOG_TIMEOUT_S;
+  cpuClockFull();       // Timer2 of ISR_STATS counts at F_CPU / ISR_STATS_PRESCALER
+  ISR_STATS_ENTER(ISR_STATS_WDT);
+  MEM_STATS_ISR_ENTER();
+  time16_ms_t period = watchdogPeriod_ms(watchdogTimeout);
+  if (sinceHeartbeat_ms < WDT_HANG_TIMEOUT_MS) {
+    sinceHeartbeat_ms += period;
+    // wake up MCU
+    _WD_CONTROL_REG |= _BV(WDIE);  // do not delete this line --> watchdog would reset MCU at next interrupt
+  } // else: main program hangs => reset at next timeout
+  time_ms += period;
+  timeCheck_ms = ~time_ms;
+  atWatchdogTick = true;
+  countResidency(period);
+  countWakeup(WAKEUP_WDT);
+  ledPatternTick(period);
+  wdtPeriodUpdate();   // back to the requested period once a pattern has ended
+  MEM_STATS_ISR_EXIT();
+  ISR_STATS_EXIT(ISR_STATS_WDT);
 }
 
 
-time32_s_t wdtTime_s() {
+time32_ms_t wdtTime_ms() {
   // Copied from millis() implementation in https://github.com/arduino/ArduinoCore-avr/blob/master/cores/arduino/wiring.c
-  time32_s_t sec;
+  time32_ms_t ms;
   uint8_t oldSREG = SREG;
 
-  // disable interrupts while we read time_s or we might get an inconsistent value (e.g. in the middle of a write to systemSeconds)
+  // disable interrupts while we read time_ms or we might get an inconsistent value (e.g. in the middle of a write to time_ms)
   cli();
-  sec  = time_s;
+  ms  = time_ms;
   SREG = oldSREG;
-  sei();
-  return sec;
+  return ms;
+}
+
+void wdtHeartbeat() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sinceHeartbeat_ms = 0;
+    atWatchdogTick = false;
+  }
+}
+
+time32_s_t wdtTime_s() {
+  return wdtTime_ms() / 1000;
 }
 
   
@@ -63,7 +134,7 @@ void disableArduinoTimer0() {
     TIMSK0 &= ~ _BV(TOIE0);           // Disable overflow interrupt
 
   #elif defined(__AVR_ATtiny85__)
-    TIMSK |= _BV(TOIE0);             // Enable overflow interrupt
+    TIMSK &= ~ _BV(TOIE0);            // Disable overflow interrupt
   #endif
   power_timer0_disable();
-}
\ No newline at end of file
+}
@@ -4,9 +4,29 @@
   #include <Arduino.h> 
   #include "io_util.h"
 
-  void configWatchdogTime();
+  // Nominal watchdog periods: 2K .. 128K cycles of the 128 kHz watchdog oscillator
+  const time16_ms_t WDT_MIN_PERIOD_MS = 16;     // WDTO_15MS
+  const time16_ms_t WDT_MAX_PERIOD_MS = 1024;   // WDTO_1S
+
+  // Hang recovery: if the main program has not gone to sleep for this long, the watchdog ISR stops re-arming itself
+  // and the watchdog resets the MCU at its next timeout (warm restart, see warm_restart.h)
+  const time16_ms_t WDT_HANG_TIMEOUT_MS = 4096;
+
+  void configWatchdogTime();   // keeps the time across a warm restart
+
+  // Main program only: called before each sleep => the program does not hang (also ends the watchdog wake-up, see wdtPeriodFor())
+  void wdtHeartbeat();
   
   time32_s_t wdtTime_s();
+  time32_ms_t wdtTime_ms();   // resolution = current watchdog period
+
+  // Sets the watchdog period to the longest period <= duration (bounded by WDT_MIN_PERIOD_MS and WDT_MAX_PERIOD_MS).
+  // The watchdog counter restarts when the period changes => the change takes effect at once right after a watchdog wake-up,
+  // otherwise at the end of the current period (the time stays accurate).
+  // While an LED pattern plays, the period is further limited to the pattern's step (see led_pattern.h).
+  void wdtPeriodFor(time16_ms_t duration);
+  // Re-applies the limit of the LED pattern engine after a pattern has been started
+  void wdtPeriodUpdate();
 
   void enableArduinoTimer0(); // Timer0 is used for millis() function --> not used by watchdog
   void disableArduinoTimer0();
@@ -0,0 +1,304 @@
+#include <avr/pgmspace.h>
+#include <stdlib.h>
+#include <string.h>
+#include "console.h"
+#include "log_io.h"
+#include "fan_control.h"
+#include "day_clock.h"
+
+#ifdef CONSOLE
+
+// Names in flash; index = enum value. Mode and intensity: MODE_UNDEF / INTENSITY_UNDEF = follow the switch
+const uint8_t CONSOLE_NAME_LENGTH = 11;
+typedef char ConsoleName[CONSOLE_NAME_LENGTH];
+const ConsoleName MODE_NAMES[] PROGMEM = {"switch", "off", "continuous", "interval"};
+const ConsoleName INTENSITY_NAMES[] PROGMEM = {"switch", "low", "medium", "high"};
+const ConsoleName STATE_NAMES[] PROGMEM = {"off", "on", "pausing", "program"};
+const ConsoleName SPEED_NAMES[] PROGMEM = {"off", "min", "medium", "full"};
+const ConsoleName DAY_NAMES[] PROGMEM = {"mon", "tue", "wed", "thu", "fri", "sat", "sun"};
+
+char consoleLine[CONSOLE_LINE_LENGTH];
+uint8_t lineLength = 0;
+bool lineOverflow = false;      // the current line has been too long => rejected at its end
+
+char consoleReply[CONSOLE_REPLY_LENGTH];
+uint8_t replyLength = 0;
+uint8_t replySent = 0;          // bytes of the reply written to the Serial TX buffer
+
+//
+// REPLY
+//
+void reply_P(const char* text) {
+  char c;
+  while ((c = pgm_read_byte(text++)) != '\0' && replyLength < CONSOLE_REPLY_LENGTH - 2) {  // room for CR LF
+    consoleReply[replyLength++] = c;
+  }
+}
+
+void replyNumber(uint32_t value) {
+  char digits[11];
+  ultoa(value, digits, 10);
+  for (char* c = digits; *c != '\0' && replyLength < CONSOLE_REPLY_LENGTH - 2; c++) {
+    consoleReply[replyLength++] = *c;
+  }
+}
+
+void replyField_P(const char* key, uint32_t value) {
+  reply_P(key);
+  replyNumber(value);
+}
+
+// hh:mm:ss
+void replyTimeOfDay(time32_s_t seconds) {
+  uint8_t fields[] = {(uint8_t) (seconds / 3600), (uint8_t) (seconds / 60 % 60), (uint8_t) (seconds % 60)};
+  for (uint8_t i = 0; i < 3; i++) {
+    reply_P(i == 0 ? PSTR("") : PSTR(":"));
+    reply_P(fields[i] < 10 ? PSTR("0") : PSTR(""));
+    replyNumber(fields[i]);
+  }
+}
+
+void replyEnd() {
+  consoleReply[replyLength++] = '\r';
+  consoleReply[replyLength++] = '\n';
+}
+
+// Writes as much of the reply as fits the TX buffer; returns true once the reply has been sent completely
+bool replyFlush() {
+  int space = Serial.availableForWrite();
+  while (replySent < replyLength && space-- > 0) {
+    Serial.write(consoleReply[replySent++]);
+  }
+  if (replySent < replyLength) {
+    return false;
+  }
+  replyLength = 0;
+  replySent = 0;
+  return true;
+}
+
+//
+// COMMANDS
+//
+int8_t lookupName(const char* word, const ConsoleName names[], uint8_t count) {
+  for (uint8_t i = 0; word != NULL && i < count; i++) {
+    if (strcmp_P(word, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void replyState() {
+  reply_P(PSTR("state mode="));
+  reply_P(MODE_NAMES[logicalIO()->fanMode()]);
+  if (logicalIO()->fanModeOverride() != MODE_UNDEF) {
+    reply_P(PSTR("*"));
+  }
+  reply_P(PSTR(" intensity="));
+  reply_P(INTENSITY_NAMES[logicalIO()->fanIntensity()]);
+  if (logicalIO()->fanIntensityOverride() != INTENSITY_UNDEF) {
+    reply_P(PSTR("*"));
+  }
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    reply_P(channel == FAN_A ? PSTR(" A=") : PSTR(" B="));
+    reply_P(STATE_NAMES[getFanState(channel)]);
+    reply_P(PSTR(","));
+    reply_P(SPEED_NAMES[logicalIO()->fanSpeed(channel)]);
+    replyField_P(PSTR(",duty="), logicalIO()->fanDutyValue(channel));
+  }
+}
+
+void replyResidency() {
+  SleepResidency r = getSleepResidency();
+  replyField_P(PSTR("residency awake="), r.awake);
+  replyField_P(PSTR(" idle="), r.idleSleep);
+  replyField_P(PSTR(" down="), r.powerDown);
+  replyField_P(PSTR(" wdt="), r.wakeups[WAKEUP_WDT]);
+  replyField_P(PSTR(" pin="), r.wakeups[WAKEUP_PIN_CHANGE]);
+  replyField_P(PSTR(" timer="), r.wakeups[WAKEUP_TIMER]);
+}
+
+void replyConfig() {
+  IntervalDurations d = getIntervalDurations();
+  replyField_P(PSTR("config on="), d.fanOn);
+  replyField_P(PSTR(" short="), d.pauseShort);
+  replyField_P(PSTR(" medium="), d.pauseMedium);
+  replyField_P(PSTR(" long="), d.pauseLong);
+  replyField_P(PSTR(" airflow="), FAN_CONTINUOUS_LOW_AIRFLOW);
+  replyField_P(PSTR(","), FAN_CONTINUOUS_MEDIUM_AIRFLOW);
+  replyField_P(PSTR(","), FAN_CONTINUOUS_HIGH_AIRFLOW);
+}
+
+void replyClock() {
+  if (! dayClockValid()) {
+    reply_P(PSTR("clock unset"));
+    return;
+  }
+  time32_s_t time = dayClockTime();
+  int32_t drift = dayClockDrift();
+  reply_P(PSTR("clock "));
+  reply_P(DAY_NAMES[time / 86400]);
+  reply_P(PSTR(" "));
+  replyTimeOfDay(time % 86400);
+  reply_P(drift < 0 ? PSTR(" drift=-") : PSTR(" drift="));
+  replyNumber(drift < 0 ? - drift : drift);
+  if (dayProfileIndex() == DAY_PROFILE_NONE) {
+    reply_P(PSTR(" profile=none"));
+  } else {
+    replyField_P(PSTR(" profile="), dayProfileIndex());
+  }
+}
+
+// clock mon..sun hh:mm[:ss]
+bool setClock(const char* day, char* time) {
+  int8_t weekday = lookupName(day, DAY_NAMES, sizeof(DAY_NAMES) / sizeof(DAY_NAMES[0]));
+  if (weekday < 0 || time == NULL) {
+    return false;
+  }
+  time32_s_t seconds = 0;
+  for (uint8_t field = 0; field < 3; field++) {
+    char* end;
+    unsigned long value = strtoul(time, & end, 10);
+    if (end == time || value >= (field == 0 ? 24 : 60)) {
+      return false;
+    }
+    seconds = seconds * 60 + value;
+    if (*end == '\0' && field > 0) {
+      if (field == 1) {
+        seconds *= 60;
+      }
+      setDayClock(weekday * 86400UL + seconds);
+      return true;
+    } else if (*end != ':') {
+      return false;
+    }
+    time = end + 1;
+  }
+  return false;
+}
+
+// set on|short|medium|long <seconds>   (1..INTERVAL_MAX_DURATION)
+bool setParameter(const char* name, const char* value) {
+  if (name == NULL || value == NULL) {
+    return false;
+  }
+  char* end;
+  unsigned long seconds = strtoul(value, & end, 10);
+  if (*end != '\0' || seconds == 0 || seconds > (unsigned long) INTERVAL_MAX_DURATION) {
+    return false;
+  }
+  IntervalDurations d = getIntervalDurations();
+  if (strcmp_P(name, PSTR("on")) == 0) {
+    d.fanOn = seconds;
+  } else if (strcmp_P(name, PSTR("short")) == 0) {
+    d.pauseShort = seconds;
+  } else if (strcmp_P(name, PSTR("medium")) == 0) {
+    d.pauseMedium = seconds;
+  } else if (strcmp_P(name, PSTR("long")) == 0) {
+    d.pauseLong = seconds;
+  } else {
+    return false;
+  }
+  setIntervalDurations(d);
+  return true;
+}
+
+void execute(char* line) {
+  char* command = strtok(line, " \t");
+  char* argument1 = strtok(NULL, " \t");
+  char* argument2 = strtok(NULL, " \t");
+  int8_t value;
+
+  if (command == NULL) {
+    return;   // empty line => no reply
+  } else if (strcmp_P(command, PSTR("state")) == 0) {
+    replyState();
+  } else if (strcmp_P(command, PSTR("rpm")) == 0) {
+    #ifdef FAN_TACH
+      replyField_P(PSTR("rpm "), getFanRpm());
+    #else
+      reply_P(PSTR("error no tach"));
+    #endif
+  } else if (strcmp_P(command, PSTR("residency")) == 0) {
+    replyResidency();
+  } else if (strcmp_P(command, PSTR("config")) == 0) {
+    replyConfig();
+  } else if (strcmp_P(command, PSTR("mode")) == 0) {
+    if ((value = lookupName(argument1, MODE_NAMES, sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]))) >= 0) {
+      logicalIO()->overrideFanMode((FanMode) value);
+      reply_P(PSTR("ok"));
+    } else {
+      reply_P(PSTR("error mode"));
+    }
+  } else if (strcmp_P(command, PSTR("intensity")) == 0) {
+    if ((value = lookupName(argument1, INTENSITY_NAMES, sizeof(INTENSITY_NAMES) / sizeof(INTENSITY_NAMES[0]))) >= 0) {
+      logicalIO()->overrideFanIntensity((FanIntensity) value);
+      reply_P(PSTR("ok"));
+    } else {
+      reply_P(PSTR("error intensity"));
+    }
+  } else if (strcmp_P(command, PSTR("clock")) == 0) {
+    #ifdef DAY_CLOCK
+      if (argument1 == NULL) {
+        replyClock();
+      } else {
+        reply_P(setClock(argument1, argument2) ? PSTR("ok") : PSTR("error clock"));
+      }
+    #else
+      reply_P(PSTR("error no clock"));
+    #endif
+  } else if (strcmp_P(command, PSTR("set")) == 0) {
+    reply_P(setParameter(argument1, argument2) ? PSTR("ok") : PSTR("error set"));
+  } else {
+    reply_P(PSTR("error command"));
+  }
+  replyEnd();
+}
+
+//
+// LINE PARSER
+//
+void consoleProcess() {
+  // an unsent reply holds back further input => the RX ring buffer stays the only queue
+  if (! replyFlush()) {
+    return;
+  }
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      if (lineOverflow) {
+        reply_P(PSTR("error line too long"));
+        replyEnd();
+      } else {
+        consoleLine[lineLength] = '\0';
+        execute(consoleLine);
+      }
+      lineLength = 0;
+      lineOverflow = false;
+      if (! replyFlush()) {
+        return;
+      }
+    } else if (lineLength < CONSOLE_LINE_LENGTH - 1) {
+      consoleLine[lineLength++] = c;
+    } else {
+      lineOverflow = true;
+    }
+  }
+}
+
+bool consolePending() {
+  return replyLength > 0 || Serial.available() > 0;
+}
+
+bool consoleIdle() {
+  return false;
+}
+
+#else
+
+void consoleProcess() { }
+bool consolePending() { return false; }
+bool consoleIdle() { return true; }
+
+#endif
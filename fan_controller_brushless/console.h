@@ -0,0 +1,49 @@
+#ifndef CONSOLE_H_INCLUDED
+  #define CONSOLE_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <io_util.h>
+  #include "phys_io.h"
+
+  //
+  // Text command console on USART0 (#define CONSOLE --> see phys_io.h), ATmega328P only.
+  //
+  // The interrupt-driven Serial RX/TX ring buffers hold the bytes on the wire. Any USART interrupt wakes the MCU from
+  // IDLE sleep; the scheduler then runs the console task (see fan_control.cpp), which parses the received bytes
+  // incrementally and writes as much of a reply as fits the TX buffer. Neither the ISRs nor a PWM update or the
+  // sleep entry ever wait for the console.
+  // The USART must keep its clock to receive => the MCU sleeps in IDLE only and the CPU clock is not scaled down.
+  //
+  // One command per line (CR and/or LF), one reply line per command; "error ..." for rejected commands:
+  //   state                                   mode, intensity (* = overridden); state, speed, duty per fan channel
+  //   rpm                                     fan A, last tach window (FAN_TACH builds only)
+  //   residency                               sleep residency [scheduler time units] and wake-ups per cause
+  //   config                                  interval durations [s], continuous airflow [‰]
+  //   mode off|continuous|interval|switch     overrides the mode switch; switch --> follow the switch again
+  //   intensity low|medium|high|switch        overrides the intensity switch
+  //   set on|short|medium|long <seconds>      interval fan-on / pause durations, 1..32767 s (see setIntervalDurations())
+  //   clock [mon..sun <hh:mm[:ss]>]           day clock, drift [ppm] and profile; sets it (DAY_CLOCK builds only)
+  //
+  const long CONSOLE_BAUD_RATE = 38400;
+  const uint8_t CONSOLE_LINE_LENGTH = 32;      // [characters] longer command lines are rejected
+  const uint8_t CONSOLE_REPLY_LENGTH = 96;     // [characters] longer replies are truncated
+
+  #ifdef CONSOLE
+    #if ! defined(__AVR_ATmega328P__)
+      #error("CONSOLE requires the USART of the ATmega328P")
+    #endif
+    #ifdef VERBOSE
+      #error("CONSOLE and VERBOSE both use USART0: the binary trace stream would garble the console")
+    #endif
+  #endif
+
+  // Parses the received bytes and executes complete command lines; returns without blocking
+  void consoleProcess();
+
+  // Returns true while received bytes or an unsent reply are waiting for consoleProcess()
+  bool consolePending();
+
+  // Returns true if the USART may stop in sleep (always false while the console is built in)
+  bool consoleIdle();
+
+#endif
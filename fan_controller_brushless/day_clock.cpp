@@ -0,0 +1,177 @@
+#include <util/atomic.h>
+#include <scheduler.h>
+#include "day_clock.h"
+#include "trace.h"
+
+#ifdef DAY_CLOCK
+
+const time32_ms_t DAY_CLOCK_WEEK_MS = DAY_CLOCK_WEEK_S * 1000;
+const uint16_t WEEK_MINUTES = DAY_CLOCK_WEEK_S / 60;
+const uint16_t DAY_MINUTES = 24 * 60;
+
+volatile bool clockPending = false;   // dayClockSet() from an ISR or the console
+volatile time32_s_t clockPendingTime;
+
+// clockValid, clockRead, clockWeek_ms, clockDrift: read by dayClockTime() (I2C ISR) => written atomically
+volatile bool clockValid = false;
+uint32_t clockRead;                   // scheduler time of the last update
+time32_ms_t clockWeek_ms;             // [ms] since Monday 00:00, corrected
+time32_ms_t clockSpan_ms;             // [ms] since the clock has been set; saturates beyond DAY_CLOCK_LEARN_MAX_S
+int32_t clockDrift = 0;               // [ppm]
+
+uint8_t profileIndex = DAY_PROFILE_NONE;
+DayProfile profile;                   // copy of DAY_PROFILES[profileIndex]
+time32_s_t profileRemaining = 0;      // [s]
+
+// The elapsed scheduler time is at most DAY_CLOCK_MAX_UPDATE_S => no overflow
+int32_t driftCorrected(int32_t elapsed, int32_t drift) {
+  return elapsed - ((elapsed / 1000) * drift / 1000 + (elapsed % 1000) * drift / 1000000);
+}
+
+void clockAdvance() {
+  uint32_t time = now();
+  int32_t elapsed = driftCorrected(time - clockRead, clockDrift);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    clockRead = time;
+    if (clockValid) {
+      clockWeek_ms = (clockWeek_ms + elapsed) % DAY_CLOCK_WEEK_MS;
+    }
+  }
+  if (clockValid && clockSpan_ms <= DAY_CLOCK_LEARN_MAX_S * 1000) {
+    clockSpan_ms += elapsed;
+  }
+}
+
+// The difference between the running clock and the new time is the drift since the clock has been set last
+void clockApply(time32_s_t weekTime) {
+  time32_ms_t time = weekTime % DAY_CLOCK_WEEK_S * 1000;
+  int32_t drift = clockDrift;
+  if (clockValid && clockSpan_ms >= DAY_CLOCK_LEARN_MIN_S * 1000 && clockSpan_ms <= DAY_CLOCK_LEARN_MAX_S * 1000) {
+    int32_t ahead = clockWeek_ms - time;   // [ms] < 0: behind
+    if (ahead > (int32_t) (DAY_CLOCK_WEEK_MS / 2)) {
+      ahead -= DAY_CLOCK_WEEK_MS;          // set across Monday 00:00
+    } else if (ahead < - (int32_t) (DAY_CLOCK_WEEK_MS / 2)) {
+      ahead += DAY_CLOCK_WEEK_MS;
+    }
+    if (ahead >= - DAY_CLOCK_LEARN_MAX_MS && ahead <= DAY_CLOCK_LEARN_MAX_MS) {
+      drift = constrain(drift + ahead * 1000 / (int32_t) (clockSpan_ms / 1000), - DAY_CLOCK_MAX_DRIFT, DAY_CLOCK_MAX_DRIFT);
+    }
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    clockDrift = drift;
+    clockWeek_ms = time;
+    clockValid = true;
+  }
+  clockSpan_ms = 0;
+}
+
+// The entry that has started last (circular over the week) is due; the earliest start after now is the next boundary
+bool profileSelect() {
+  uint8_t index = DAY_PROFILE_NONE;
+  profileRemaining = 0;
+  if (clockValid) {
+    uint16_t minute = clockWeek_ms / 60000;
+    uint16_t minAge = UINT16_MAX;
+    uint16_t minUntil = UINT16_MAX;
+    for (uint8_t i = 0; i < DAY_PROFILE_ENTRIES; i++) {
+      uint8_t days = pgm_read_byte(& DAY_PROFILES[i].days);
+      uint16_t start = pgm_read_word(& DAY_PROFILES[i].start);
+      for (uint8_t day = 0; day < 7; day++) {
+        if (days & _BV(day)) {
+          uint16_t weekStart = day * DAY_MINUTES + start;
+          uint16_t age = (minute + WEEK_MINUTES - weekStart) % WEEK_MINUTES;          // [min] 0 .. WEEK_MINUTES - 1
+          uint16_t until = (weekStart + WEEK_MINUTES - minute - 1) % WEEK_MINUTES + 1;  // [min] 1 .. WEEK_MINUTES
+          if (age < minAge) {
+            minAge = age;
+            index = i;
+          }
+          minUntil = min(minUntil, until);
+        }
+      }
+    }
+    if (index != DAY_PROFILE_NONE) {
+      profileRemaining = (time32_s_t) minUntil * 60 - (clockWeek_ms / 1000) % 60;
+    }
+  }
+  if (index == profileIndex) {
+    return false;
+  }
+  profileIndex = index;
+  if (index != DAY_PROFILE_NONE) {
+    memcpy_P(& profile, & DAY_PROFILES[index], sizeof(DayProfile));
+  }
+  TRACE(TRACE_DAY_PROFILE, index, clockWeek_ms / 60000);
+  return true;
+}
+
+void dayClockSet(time32_s_t weekTime) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    clockPendingTime = weekTime;
+    clockPending = true;
+  }
+}
+
+bool dayClockUpdate() {
+  bool pending;
+  time32_s_t weekTime;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pending = clockPending;
+    weekTime = clockPendingTime;
+    clockPending = false;
+  }
+  clockAdvance();
+  if (pending) {
+    clockApply(weekTime);
+  }
+  return profileSelect();
+}
+
+bool dayClockValid() {
+  return clockValid;
+}
+
+time32_s_t dayClockTime() {
+  time32_ms_t week;
+  uint32_t read;
+  int32_t drift;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    week = clockWeek_ms;
+    read = clockRead;
+    drift = clockDrift;
+  }
+  return (week + driftCorrected(now() - read, drift)) % DAY_CLOCK_WEEK_MS / 1000;
+}
+
+int32_t dayClockDrift() {
+  return clockDrift;
+}
+
+time32_s_t dayProfileRemaining() {
+  return profileRemaining;
+}
+
+uint8_t dayProfileIndex() {
+  return profileIndex;
+}
+
+FanSpeed dayProfileSpeedCap() {
+  return profileIndex == DAY_PROFILE_NONE ? SPEED_FULL : profile.speedCap;
+}
+
+uint8_t dayProfilePauseScale() {
+  return profileIndex == DAY_PROFILE_NONE ? 100 : profile.pauseScale;
+}
+
+#else
+
+void dayClockSet(time32_s_t weekTime) { }
+bool dayClockUpdate() { return false; }
+bool dayClockValid() { return false; }
+time32_s_t dayClockTime() { return 0; }
+int32_t dayClockDrift() { return 0; }
+time32_s_t dayProfileRemaining() { return 0; }
+uint8_t dayProfileIndex() { return DAY_PROFILE_NONE; }
+FanSpeed dayProfileSpeedCap() { return SPEED_FULL; }
+uint8_t dayProfilePauseScale() { return 100; }
+
+#endif
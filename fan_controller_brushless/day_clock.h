@@ -0,0 +1,75 @@
+#ifndef DAY_CLOCK_H_INCLUDED
+  #define DAY_CLOCK_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <avr/pgmspace.h>
+  #include <io_util.h>
+  #include "log_io.h"
+
+  //
+  // Time-of-day profiles (#define DAY_CLOCK --> see phys_io.h).
+  //
+  // The day clock counts the time since Monday 00:00 on the scheduler time (watchdog based). It runs once it has
+  // been set over the console or I2C (see console.h, i2c_slave.h) and is lost on reset; without a clock, no profile
+  // applies (DAY_PROFILE_NONE).
+  // The watchdog oscillator is off by a few % and drifts with temperature: when the clock is set again after
+  // DAY_CLOCK_LEARN_MIN_S .. DAY_CLOCK_LEARN_MAX_S, the difference is taken as the rate error of the scheduler time
+  // and corrected from then on. A larger difference than DAY_CLOCK_LEARN_MAX_MS is a deliberate change (daylight
+  // saving time, another time zone) and is taken as it is.
+  //
+  // The profile that is due is looked up only when the clock is set and at the profile boundaries (clock task in
+  // fan_control.cpp); every phase start reads the selected profile. A new profile is applied like an intensity change.
+  //
+  typedef struct {
+    uint8_t days;           // DAY_... bits of the days the entry starts on
+    uint16_t start;         // [min] since midnight
+    FanSpeed speedCap;      // highest speed of the fans (see LogicalIOModel::speedCap())
+    uint8_t pauseScale;     // [%] of the interval pauses
+  } DayProfile;
+
+  const uint8_t DAY_MONDAY = _BV(0);
+  const uint8_t DAY_TUESDAY = _BV(1);
+  const uint8_t DAY_WEDNESDAY = _BV(2);
+  const uint8_t DAY_THURSDAY = _BV(3);
+  const uint8_t DAY_FRIDAY = _BV(4);
+  const uint8_t DAY_SATURDAY = _BV(5);
+  const uint8_t DAY_SUNDAY = _BV(6);
+  const uint8_t DAY_WORKDAYS = DAY_MONDAY | DAY_TUESDAY | DAY_WEDNESDAY | DAY_THURSDAY | DAY_FRIDAY;
+  const uint8_t DAY_WEEKEND = DAY_SATURDAY | DAY_SUNDAY;
+  const uint8_t DAY_ALL = DAY_WORKDAYS | DAY_WEEKEND;
+
+  // An entry lasts until the next entry starts (on any day); any order
+  const DayProfile DAY_PROFILES[] PROGMEM = {
+    { DAY_WORKDAYS,  7*60, SPEED_FULL, 100 },
+    { DAY_WEEKEND,   9*60, SPEED_FULL, 100 },
+    { DAY_ALL,      22*60, SPEED_MIN,  200 }     // quiet hours: low speed, pauses twice as long
+  };
+  const uint8_t DAY_PROFILE_ENTRIES = sizeof(DAY_PROFILES) / sizeof(DAY_PROFILES[0]);
+  const uint8_t DAY_PROFILE_NONE = 0xFF;        // index: no clock => no cap, pauses unchanged
+
+  const time32_s_t DAY_CLOCK_WEEK_S = 7 * 24 * 3600UL;
+  const time32_s_t DAY_CLOCK_LEARN_MIN_S = 24 * 3600UL;       // [s] shorter spans: the 1 s resolution of a set dominates
+  const time32_s_t DAY_CLOCK_LEARN_MAX_S = 20 * 24 * 3600UL;  // [s] within the range of the 32-bit [ms] span
+  const int32_t DAY_CLOCK_LEARN_MAX_MS = 1800000L;            // [ms] larger differences are not drift
+  const int32_t DAY_CLOCK_MAX_DRIFT = 100000L;                // [ppm] 10 %
+  // [s] the clock task runs at least this often: the drift correction of the elapsed time stays within 32 bits
+  const time32_s_t DAY_CLOCK_MAX_UPDATE_S = 3600;
+
+  // ISR-safe; weekTime [s] since Monday 00:00. Takes effect with the next dayClockUpdate().
+  void dayClockSet(time32_s_t weekTime);
+
+  // Applies a pending dayClockSet(), advances the clock to the scheduler time and selects the profile that is due.
+  // Returns true if another profile has been selected.
+  bool dayClockUpdate();
+
+  bool dayClockValid();
+  time32_s_t dayClockTime();        // [s] since Monday 00:00; ISR-safe
+  int32_t dayClockDrift();          // [ppm] rate error of the scheduler time: > 0 --> runs fast
+  time32_s_t dayProfileRemaining(); // [s] from the last dayClockUpdate() to the next profile boundary; 0: none
+
+  // The profile selected by the last dayClockUpdate(); DAY_PROFILE_NONE: no cap, pauses unchanged
+  uint8_t dayProfileIndex();
+  FanSpeed dayProfileSpeedCap();
+  uint8_t dayProfilePauseScale();   // [%]
+
+#endif
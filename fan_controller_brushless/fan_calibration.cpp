@@ -0,0 +1,28 @@
+#include "fan_calibration.h"
+
+pwm_duty_t calibrationDutyValue(uint8_t point) {
+  return pgm_read_byte(& FAN_CALIBRATION[point].dutyValue);
+}
+
+permille_t calibrationAirflow(uint8_t point) {
+  return pgm_read_word(& FAN_CALIBRATION[point].airflow);
+}
+
+pwm_duty_t dutyValueForAirflow(permille_t airflow) {
+  uint8_t point = 0;
+  while (point < FAN_CALIBRATION_POINTS - 2 && airflow > calibrationAirflow(point + 1)) {
+    point++;
+  }
+  permille_t a0 = calibrationAirflow(point);
+  permille_t a1 = calibrationAirflow(point + 1);
+  pwm_duty_t d0 = calibrationDutyValue(point);
+  pwm_duty_t d1 = calibrationDutyValue(point + 1);
+  if (airflow <= a0) {
+    return d0;
+  }
+  if (airflow >= a1) {
+    return d1;
+  }
+  // round up => the airflow at the returned duty value is not below the requested one
+  return d0 + ((uint32_t) (d1 - d0) * (airflow - a0) + (a1 - a0 - 1)) / (a1 - a0);
+}
@@ -0,0 +1,35 @@
+#ifndef FAN_CALIBRATION_H_INCLUDED
+  #define FAN_CALIBRATION_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <avr/pgmspace.h>
+  #include <io_util.h>
+
+  //
+  // Airflow of the fan over the PWM duty value, used to map the continuous intensities onto duty values (see phys_io.h).
+  //
+  // 4-pin fans are strongly nonlinear near the stall point. Generate the table for the actual fan with 
+  // fan_test.ino (VERBOSE) and tools/fan_characterise.py; airflow is taken as proportional to the RPM.
+  // Defaults: the former fixed duty values 20 (threshold) and 35 (medium) at 25 % and 40 % airflow.
+  //
+  typedef uint16_t permille_t;
+
+  typedef struct {
+    pwm_duty_t dutyValue;  // ascending; first point: FAN_LOW_THRESHOLD_DUTY_VALUE, last point: PWM_DUTY_MAX
+    permille_t airflow;    // [‰] of the airflow at PWM_DUTY_MAX; ascending
+  } FanCalibrationPoint;
+
+  const FanCalibrationPoint FAN_CALIBRATION[] PROGMEM = {
+    {  20,  250 },
+    {  35,  400 },
+    {  64,  560 },
+    { 128,  780 },
+    { 255, 1000 }
+  };
+  const uint8_t FAN_CALIBRATION_POINTS = sizeof(FAN_CALIBRATION) / sizeof(FAN_CALIBRATION[0]);
+
+  // Lowest duty value that delivers at least the given airflow (linear interpolation between the points, rounded up);
+  // never below the stall threshold (first point)
+  pwm_duty_t dutyValueForAirflow(permille_t airflow);
+
+#endif
@@ -1,25 +1,112 @@
 #include <Arduino.h> 
 #include <avr/sleep.h>
+#include <util/atomic.h>
 #include <scheduler.h>
 #include <wdt_scheduler.h>
 #include <blink_task.h>
 #include "log_io.h"
 #include "fan_control.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "mem_stats.h"
+#include "console.h"
+#include "telemetry.h"
+#include "i2c_slave.h"
+#include "interval_program.h"
+#include "day_clock.h"
 
 const TaskGroup MODE_CHANGED_GROUP = 1;
 const TaskGroup INTENSITY_CHANGED_GROUP = 2;
 const TaskGroup SPEED_TRANSITION_GROUP = 3;
 const TaskGroup INTERVAL_GROUP = 4;
 const TaskGroup PAUSE_SHOW_ALIVE_GROUP = 5;
-#define NUM_TASK_GROUPS 5
+const TaskGroup TACH_WINDOW_GROUP = 6;      // FAN_TACH only
+const TaskGroup TACH_MEASURE_GROUP = 7;     // FAN_TACH only
+const TaskGroup INTERVAL_B_GROUP = 8;       // DUAL_FAN only
+const TaskGroup FAN_B_START_GROUP = 9;      // DUAL_FAN only
+const TaskGroup CONSOLE_GROUP = 10;         // CONSOLE only
+const TaskGroup TELEMETRY_GROUP = 11;       // LED_TELEMETRY only
+const TaskGroup PROGRAM_GROUP = 12;         // INTERVAL_PROGRAM only
+const TaskGroup DAY_CLOCK_GROUP = 13;       // DAY_CLOCK only
+const TaskGroup BOOT_GROUP = 14;
+#ifdef FAN_TACH
+  #define TACH_TASK_GROUPS 2
+#else
+  #define TACH_TASK_GROUPS 0
+#endif
+#ifdef DUAL_FAN
+  #define DUAL_FAN_TASK_GROUPS 2
+#else
+  #define DUAL_FAN_TASK_GROUPS 0
+#endif
+#ifdef CONSOLE
+  #define CONSOLE_TASK_GROUPS 1
+#else
+  #define CONSOLE_TASK_GROUPS 0
+#endif
+#ifdef LED_TELEMETRY
+  #define TELEMETRY_TASK_GROUPS 1
+#else
+  #define TELEMETRY_TASK_GROUPS 0
+#endif
+#ifdef INTERVAL_PROGRAM
+  #define PROGRAM_TASK_GROUPS 1
+#else
+  #define PROGRAM_TASK_GROUPS 0
+#endif
+#ifdef DAY_CLOCK
+  #define DAY_CLOCK_TASK_GROUPS 1
+#else
+  #define DAY_CLOCK_TASK_GROUPS 0
+#endif
+#define NUM_TASK_GROUPS (6 + TACH_TASK_GROUPS + DUAL_FAN_TASK_GROUPS + CONSOLE_TASK_GROUPS + TELEMETRY_TASK_GROUPS \
+  + PROGRAM_TASK_GROUPS + DAY_CLOCK_TASK_GROUPS)
 
 #if NUM_TASK_GROUPS > MAX_SCHEDULER_TASK_GROUPS
  #error("The static Scheduler task group limit is MAX_SCHEDULER_TASK_GROUPS")
 #endif
-const TaskGroup TASK_GROUPS[NUM_TASK_GROUPS] = {MODE_CHANGED_GROUP, INTENSITY_CHANGED_GROUP, SPEED_TRANSITION_GROUP, INTERVAL_GROUP, PAUSE_SHOW_ALIVE_GROUP};
+const TaskGroup TASK_GROUPS[NUM_TASK_GROUPS] = {MODE_CHANGED_GROUP, INTENSITY_CHANGED_GROUP, SPEED_TRANSITION_GROUP, INTERVAL_GROUP, PAUSE_SHOW_ALIVE_GROUP
+    , BOOT_GROUP
+  #ifdef FAN_TACH
+    , TACH_WINDOW_GROUP, TACH_MEASURE_GROUP
+  #endif
+  #ifdef DUAL_FAN
+    , INTERVAL_B_GROUP, FAN_B_START_GROUP
+  #endif
+  #ifdef CONSOLE
+    , CONSOLE_GROUP
+  #endif
+  #ifdef LED_TELEMETRY
+    , TELEMETRY_GROUP
+  #endif
+  #ifdef INTERVAL_PROGRAM
+    , PROGRAM_GROUP
+  #endif
+  #ifdef DAY_CLOCK
+    , DAY_CLOCK_GROUP
+  #endif
+};
+
+// Tach pulse stretching (FAN_TACH, see phys_io.h): every TACH_PERIOD, the fan supply is held on for TACH_SETTLE + 
+// TACH_MEASURE (the fan speeds up slightly meanwhile); pulses are counted during TACH_MEASURE only, once the fan 
+// electronics have powered up.
+const SDuration TACH_PERIOD = 30*D_1S;
+const SDuration TACH_SETTLE = D_250MS;
+const SDuration TACH_MEASURE = D_1S;
+uint16_t lastFanRpm = 0;    // [RPM] of the last tach window
+
+// Telemetry (LED_TELEMETRY, see telemetry.h): a frame follows the last of a burst of events after TELEMETRY_DELAY; 
+// it waits for the LED animations in steps of TELEMETRY_RETRY
+const SDuration TELEMETRY_DELAY = D_1S;
+const SDuration TELEMETRY_RETRY = D_500MS;
 
 // forward declaration:
+void handleStateTransition(FanChannel channel, Event event);
 void handleStateTransition(Event event);
+void scheduleConsoleTask();
+void scheduleIntensityChangedTask();
+void programDuty(pwm_duty_t value);
+void restartIntervalOnPhase(FanChannel channel);
 
 
 class FanScheduler : public WatchdogTimerBasedScheduler {
@@ -28,13 +115,33 @@ class FanScheduler : public WatchdogTimerBasedScheduler {
   
   protected:
     bool stopTimersDuringSleep() { 
+      traceDrain();  // the scheduler is about to sleep => send buffered trace records now
       // Timer1 is needed for PWM: while fan is running at other than 100% duty cycle => cannot turn MCU off 
-      return ! logicalIO()->isPwmActive();
+      // USART needs its clock until the trace records have been sent, and always while the console listens
+      // Timer0 needs its clock until the telemetry burst has been sent
+      bool serialIdle = traceIdle() && consoleIdle() && telemetryIdle();
+      // TWI / USI: a transaction continues in IDLE only (POWER-DOWN: address match / start condition only)
+      bool stopTimers = ! logicalIO()->isPwmActive() && serialIdle && i2cSlaveIdle();
+      residencySleeping(stopTimers ? CPU_POWER_DOWN : CPU_IDLE_SLEEP, now());
+      peripheralsOffForSleep();
+      if (! stopTimers && serialIdle) {
+        // IDLE sleep with PWM running: not while a serial line is in use, its baud rate would change
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          cpuClockSlow();
+        }
+      }
+      return stopTimers;
     }
     
-    #if defined(__AVR_ATmega328P__)
-      void wakingUp() { logicalIO()->wdtWakeupLEDBlip(); }
-    #endif
+    void wakingUp() { 
+      cpuClockFull();   // no-op if a pin-change ISR has already restored the clock
+      peripheralsOnAfterSleep();
+      residencyAwake(now());
+      #if defined(__AVR_ATmega328P__)
+        logicalIO()->wdtWakeupLEDBlip(); 
+      #endif
+      scheduleConsoleTask();  // the USART RX and TX interrupts wake the MCU from IDLE sleep
+    }
 };
 
 class ModeChangedTask : public AbstractTask {
@@ -43,6 +150,8 @@ class ModeChangedTask : public AbstractTask {
     const char *name() { return "Mode"; }
     void action() {
       handleStateTransition(MODE_CHANGED);
+      reportIsrStats();
+      reportMemStats();
     }
 };
 
@@ -57,32 +166,186 @@ class IntensityChangedTask : public AbstractTask {
 
 class IntervalPhaseSwitcherTask : public BlinkTask {
   public:
-    IntervalPhaseSwitcherTask() : BlinkTask (INTERVAL_GROUP, 0 /* ledPin: value 0 is unused */) { };  // infinite (i.e. until canceled)
+    IntervalPhaseSwitcherTask(TaskGroup group, FanChannel channel) 
+      : BlinkTask (group, 0 /* ledPin: value 0 is unused */), channel(channel) { };  // infinite (i.e. until canceled)
     const char *name() { return "Interval"; }
     void deactivateSeries() { } // disable offAction, which would cause an unwanted event when we are already in another mode
 
    protected:
+      FanChannel channel;
       virtual void onAction()  { 
-        handleStateTransition(INTERVAL_PHASE_ENDED);
+        handleStateTransition(channel, INTERVAL_PHASE_ENDED);
       }
       virtual void offAction() { 
-        handleStateTransition(INTERVAL_PHASE_ENDED);
+        handleStateTransition(channel, INTERVAL_PHASE_ENDED);
       }
 };
 
+#ifdef DUAL_FAN
+  // Deferred spin-up of fan B (see DUAL_FAN_START_OFFSET)
+  class FanStartTask : public AbstractTask {
+    public:
+      FanSpeed speed = SPEED_OFF;
+      TaskGroup group() { return FAN_B_START_GROUP; }
+      const char *name() { return "Fan B start"; }
+      void action() {
+        logicalIO()->fanSpeed(FAN_B, speed);
+        restartIntervalOnPhase(FAN_B);
+      }
+  };
+#endif
+
+#ifdef CONSOLE
+  // Parses the received command lines in the main program, never inside the USART ISRs
+  class ConsoleTask : public AbstractTask {
+    public:
+      TaskGroup group() { return CONSOLE_GROUP; }
+      const char *name() { return "Console"; }
+      void action() {
+        consoleProcess();
+      }
+  };
+#endif
+
+#ifdef INTERVAL_PROGRAM
+  // One program for all channels in FAN_PROGRAM; sleeps between its steps
+  class ProgramTask : public AbstractTask {
+    public:
+      TaskGroup group() { return PROGRAM_GROUP; }
+      const char *name() { return "Program"; }
+      void action();
+  };
+#endif
+
+#ifdef DAY_CLOCK
+  // Runs at the profile boundaries (see day_clock.h), and at least every DAY_CLOCK_MAX_UPDATE_S while the clock runs
+  class DayClockTask : public AbstractTask {
+    public:
+      TaskGroup group() { return DAY_CLOCK_GROUP; }
+      const char *name() { return "Clock"; }
+      void action();
+  };
+#endif
+
 // 
 // Singleton instances
 //
 FanScheduler FAN_SCHEDULER = FanScheduler(TASK_GROUPS, NUM_TASK_GROUPS);
 
-BlinkTask SPEED_TRANSITION_BLINKER = BlinkTask(SPEED_TRANSITION_GROUP, STATUS_LED_OUT_PIN, 5);
-BlinkTask INTENTITY_CHANGED_FEEDBACK_BLINKER = BlinkTask(SPEED_TRANSITION_GROUP, STATUS_LED_OUT_PIN, 2);
-BlinkTask PAUSE_SHOW_ALIVE = BlinkTask(PAUSE_SHOW_ALIVE_GROUP, STATUS_LED_OUT_PIN); // infinite (= runs until canceled)
-IntervalPhaseSwitcherTask INTERVAL_PHASE_SWITCHER = IntervalPhaseSwitcherTask(); // infinite (= runs until canceled)
+#ifdef FAN_TACH
+  class TachMeasureTask : public AbstractTask {
+    public:
+      TaskGroup group() { return TACH_MEASURE_GROUP; }
+      const char *name() { return "Tach"; }
+      void action() {
+        tachCounting(true);
+      }
+  };
+  TachMeasureTask TACH_MEASURE_TASK = TachMeasureTask();
+
+  class TachWindowTask : public BlinkTask {
+    public:
+      TachWindowTask() : BlinkTask (TACH_WINDOW_GROUP, 0 /* ledPin: value 0 is unused */) { };  // infinite (i.e. until canceled)
+      const char *name() { return "TachWindow"; }
+      void deactivateSeries() { } // disable offAction: the window is closed by updateTachWindow()
+
+    protected:
+      virtual void onAction() { 
+        pwmStretch(FAN_A, true);
+        FAN_SCHEDULER.scheduleTask(& TACH_MEASURE_TASK, TACH_SETTLE);
+      }
+      virtual void offAction() { 
+        uint16_t pulses = tachPulses();
+        tachCounting(false);
+        pwmStretch(FAN_A, false);
+        uint16_t rpm = (uint32_t) pulses * 60 * D_1S / (TACH_PULSES_PER_REVOLUTION * TACH_MEASURE);
+        lastFanRpm = rpm;
+        TRACE(TRACE_FAN_RPM, 0, rpm);
+      }
+  };
+#endif
+
+#ifdef STATUS_LED
+  BlinkTask SPEED_TRANSITION_BLINKER = BlinkTask(SPEED_TRANSITION_GROUP, STATUS_LED_OUT_PIN, 5);
+  BlinkTask INTENTITY_CHANGED_FEEDBACK_BLINKER = BlinkTask(SPEED_TRANSITION_GROUP, STATUS_LED_OUT_PIN, 2);
+  BlinkTask PAUSE_SHOW_ALIVE = BlinkTask(PAUSE_SHOW_ALIVE_GROUP, STATUS_LED_OUT_PIN); // infinite (= runs until canceled)
+  BlinkTask BOOT_BLINKER = BlinkTask(BOOT_GROUP, STATUS_LED_OUT_PIN, 1);  // own group: input changes do not preempt it
+#endif
+IntervalPhaseSwitcherTask INTERVAL_PHASE_SWITCHER[FAN_CHANNELS] = { // infinite (= runs until canceled)
+  IntervalPhaseSwitcherTask(INTERVAL_GROUP, FAN_A)
+  #ifdef DUAL_FAN
+    , IntervalPhaseSwitcherTask(INTERVAL_B_GROUP, FAN_B)
+  #endif
+};
+#ifdef DUAL_FAN
+  FanStartTask FAN_B_START_TASK = FanStartTask();
+#endif
 ModeChangedTask MODE_CHANGED_TASK = ModeChangedTask();
+#ifdef FAN_TACH
+  TachWindowTask TACH_WINDOW = TachWindowTask(); // infinite (= runs until canceled)
+#endif
 IntensityChangedTask INTENSITY_CHANGED_TASK = IntensityChangedTask();
+#ifdef CONSOLE
+  ConsoleTask CONSOLE_TASK = ConsoleTask();
+#endif
+
+#ifdef INTERVAL_PROGRAM
+  ProgramTask PROGRAM_TASK = ProgramTask();
+
+  void ProgramTask::action() {
+    duration16_s_t wait = intervalProgramStep(logicalIO()->fanIntensity());
+    programDuty(intervalProgramDuty());
+    if (wait > 0) {
+      FAN_SCHEDULER.scheduleTask(this, wait*D_1S);
+    }
+  }
+#endif
 
-volatile FanState fanState = FAN_OFF;          // current fan state
+#ifdef DAY_CLOCK
+  DayClockTask DAY_CLOCK_TASK = DayClockTask();
+
+  // A new profile is applied like an intensity change: a continuous speed and a running pause adapt at once
+  void DayClockTask::action() {
+    if (dayClockUpdate()) {
+      logicalIO()->speedCap(dayProfileSpeedCap());
+      scheduleIntensityChangedTask();
+    }
+    if (dayClockValid()) {
+      FAN_SCHEDULER.scheduleTask(this, min(dayProfileRemaining(), DAY_CLOCK_MAX_UPDATE_S) * D_1S);
+    }
+  }
+#endif
+
+#ifdef LED_TELEMETRY
+  // The burst drives the status LED pin => it must not overlap an LED animation, a blip or another burst
+  class TelemetryTask : public AbstractTask {
+    public:
+      TaskGroup group() { return TELEMETRY_GROUP; }
+      const char *name() { return "Telemetry"; }
+      void action() {
+        if (ledBusy()) {
+          FAN_SCHEDULER.scheduleTask(this, TELEMETRY_RETRY);
+        } else {
+          telemetrySend();
+        }
+      }
+
+    protected:
+      bool ledBusy() {
+        return ! telemetryIdle() 
+          || FAN_SCHEDULER.taskForGroup(SPEED_TRANSITION_GROUP) != NULL
+          || FAN_SCHEDULER.taskForGroup(BOOT_GROUP) != NULL
+          || (FAN_SCHEDULER.taskForGroup(PAUSE_SHOW_ALIVE_GROUP) != NULL 
+              && PAUSE_SHOW_ALIVE.dueTime() - now() <= TELEMETRY_BURST_MS * D_1S / 1000);
+      }
+  };
+  TelemetryTask TELEMETRY_TASK = TelemetryTask();
+#endif
+
+volatile FanState fanState[FAN_CHANNELS];      // current fan state per channel (initially FAN_OFF)
+IntervalDurations intervals = {                // [s] see setIntervalDurations()
+  INTERVAL_FAN_ON_DURATION, INTERVAL_PAUSE_SHORT_DURATION, INTERVAL_PAUSE_MEDIUM_DURATION, INTERVAL_PAUSE_LONG_DURATION
+};
 
 //
 // FUNCTIONS
@@ -90,29 +353,73 @@ volatile FanState fanState = FAN_OFF;          // current fan state
 void controllerLoop() { FAN_SCHEDULER.loop();  }
 
 //
-// Used as interrupt handlers => becomes a task factory
+// Cancels a running speed-transition or intensity-change animation so a new user input can be applied at once;
+// the state transition that follows restarts the animation if one is needed.
 //
-void scheduleModeChangeTask() {
+void preemptSpeedTransition() {
   AbstractTask* speedTransition = FAN_SCHEDULER.taskForGroup(SPEED_TRANSITION_GROUP);
   if (speedTransition != NULL) {
-    // a speed transition is underway => process update when it's done
-    FAN_SCHEDULER.scheduleTask(& MODE_CHANGED_TASK, speedTransition->timeToCompletion());
-  } else {
-    FAN_SCHEDULER.scheduleTaskNow(& MODE_CHANGED_TASK);
+    FAN_SCHEDULER.cancelTask(speedTransition);
+    logicalIO()->statusLED(false);  // animation may have been cut short in its ON phase
   }
 }
 
+// A fan start replaces the boot blink by its speed-transition animation
+void endBootBlink() {
+  #ifdef STATUS_LED
+    if (FAN_SCHEDULER.taskForGroup(BOOT_GROUP) != NULL) {
+      FAN_SCHEDULER.cancelTask(& BOOT_BLINKER);
+      logicalIO()->statusLED(false);  // blink may have been cut short in its ON phase
+    }
+  #endif
+}
+
+// Fan A pausing in mode INTERVAL: the status LED blips every INTERVAL_PAUSE_BLIP_PERIOD, for the first time after that
+void startPauseShowAlive() {
+  #ifdef STATUS_LED
+    FAN_SCHEDULER.scheduleTask(& PAUSE_SHOW_ALIVE, PAUSE_SHOW_ALIVE.offDuration());
+  #endif
+}
+
+void endPauseShowAlive() {
+  #ifdef STATUS_LED
+    FAN_SCHEDULER.cancelTask(& PAUSE_SHOW_ALIVE);
+  #endif
+}
+
+// Invoked after every wake-up: while received bytes or a reply are waiting, the console task runs once
+void scheduleConsoleTask() {
+  #ifdef CONSOLE
+    if (consolePending() && FAN_SCHEDULER.taskForGroup(CONSOLE_GROUP) == NULL) {
+      FAN_SCHEDULER.scheduleTaskNow(& CONSOLE_TASK);
+    }
+  #endif
+}
+
+// A later event postpones the frame => it carries the settled state
+void scheduleTelemetryTask() {
+  #ifdef LED_TELEMETRY
+    FAN_SCHEDULER.cancelTask(& TELEMETRY_TASK);
+    FAN_SCHEDULER.scheduleTask(& TELEMETRY_TASK, TELEMETRY_DELAY);
+  #endif
+}
+
+//
+// Used as interrupt handlers => becomes a task factory
+//
+void scheduleModeChangeTask() {
+  preemptSpeedTransition();
+  FAN_SCHEDULER.cancelTask(& MODE_CHANGED_TASK);  // a pending change is superseded by this one
+  FAN_SCHEDULER.scheduleTaskNow(& MODE_CHANGED_TASK);
+}
+
 //
 // Used as interrupt handlers => becomes a task factory
 //
 void scheduleIntensityChangedTask() {
-  AbstractTask* speedTransition = FAN_SCHEDULER.taskForGroup(SPEED_TRANSITION_GROUP);
-  if (speedTransition != NULL) {
-    // a speed transition is underway => process update when it's done
-    FAN_SCHEDULER.scheduleTask(& INTENSITY_CHANGED_TASK, speedTransition->timeToCompletion());
-  } else {
-    FAN_SCHEDULER.scheduleTaskNow(& INTENSITY_CHANGED_TASK);
-  }
+  preemptSpeedTransition();
+  FAN_SCHEDULER.cancelTask(& INTENSITY_CHANGED_TASK);  // a pending change is superseded by this one
+  FAN_SCHEDULER.scheduleTaskNow(& INTENSITY_CHANGED_TASK);
 }
 
 // Applicable only in mode CONTINUOUS
@@ -127,91 +434,175 @@ FanSpeed mapToFanSpeed(FanIntensity intensity) {
 // Applicable only in mode INTERVAL
 // Returns [s]
 time16_s_t mapToIntervalPauseDuration(FanIntensity intensity) {
+  IntervalDurations durations = getIntervalDurations();
+  uint32_t pause;
   switch(intensity) {
-    case INTENSITY_HIGH:    return INTERVAL_PAUSE_SHORT_DURATION; // [s]
-    case INTENSITY_MEDIUM:  return INTERVAL_PAUSE_MEDIUM_DURATION; // [s]
-    default:                return INTERVAL_PAUSE_LONG_DURATION; // [s]
+    case INTENSITY_HIGH:    pause = durations.pauseShort; break; // [s]
+    case INTENSITY_MEDIUM:  pause = durations.pauseMedium; break; // [s]
+    default:                pause = durations.pauseLong; break; // [s]
   }
+  // time-of-day profile (DAY_CLOCK): the selected profile is looked up once per pause
+  return min(pause * dayProfilePauseScale() / 100, (uint32_t) INT16_MAX);
 }
   
-#ifdef VERBOSE
-  const char* fanStateName(FanState state) {
-    switch (state) {
-      case FAN_OFF: return "OFF";
-      case FAN_ON: return "ON";
-      case FAN_PAUSING: return "PAUSE";
-      default: return "?";
-    }
-  }
-  
-  const char* eventName(Event event) {
-    switch (event) {
-      case EVENT_NONE: return "NONE";
-      case MODE_CHANGED: return "Mode changed";
-      case INTENSITY_CHANGED: return "Intensity changed";
-      case INTERVAL_PHASE_ENDED: return "Phase ended";
-      default: return "?";
-    }
-  }
-#endif
-
+// (Re-)starts the animation from its beginning, replacing any other animation of the SPEED_TRANSITION_GROUP
 void animateSpeedTransition() {
-   FAN_SCHEDULER.scheduleTaskNow(& SPEED_TRANSITION_BLINKER);
+  #ifdef STATUS_LED
+    preemptSpeedTransition();
+    FAN_SCHEDULER.scheduleTaskNow(& SPEED_TRANSITION_BLINKER);
+  #endif
 }
 
 void animateIntensityChange() {
-  FAN_SCHEDULER.scheduleTaskNow(& INTENTITY_CHANGED_FEEDBACK_BLINKER);
+  #ifdef STATUS_LED
+    preemptSpeedTransition();
+    FAN_SCHEDULER.scheduleTaskNow(& INTENTITY_CHANGED_FEEDBACK_BLINKER);
+  #endif
 }
 
-void updateIntervalPhaseSwitcherPause() {
+void updateIntervalPhaseSwitcherPause(FanChannel channel) {
   duration16_s_t duration =  mapToIntervalPauseDuration(logicalIO()->fanIntensity());
-  INTERVAL_PHASE_SWITCHER.delays(INTERVAL_FAN_ON_DURATION*D_1S, duration*D_1S);
+  INTERVAL_PHASE_SWITCHER[channel].delays(getIntervalDurations().fanOn*D_1S, duration*D_1S);
 }
 
-void startIntervalModeNow() {
-  updateIntervalPhaseSwitcherPause();
-  FAN_SCHEDULER.scheduleTaskNow(& INTERVAL_PHASE_SWITCHER);
+void startIntervalModeNow(FanChannel channel) {
+  updateIntervalPhaseSwitcherPause(channel);
+  FAN_SCHEDULER.scheduleTaskNow(& INTERVAL_PHASE_SWITCHER[channel]);
 }
 
-void endIntervalMode() {
-  FAN_SCHEDULER.cancelTask(& INTERVAL_PHASE_SWITCHER);
-  FAN_SCHEDULER.cancelTask(& PAUSE_SHOW_ALIVE);
+// The fan has just spun up later than its interval phase switched (see fanSpeed()) => the on-phase counts from now
+void restartIntervalOnPhase(FanChannel channel) {
+  if (fanState[channel] == FAN_ON && logicalIO()->fanMode() == MODE_INTERVAL) {
+    FAN_SCHEDULER.rescheduleTask(& INTERVAL_PHASE_SWITCHER[channel], getIntervalDurations().fanOn*D_1S);
+  }
+}
+
+// The status LED shows the pause of fan A only
+void endIntervalMode(FanChannel channel) {
+  FAN_SCHEDULER.cancelTask(& INTERVAL_PHASE_SWITCHER[channel]);
+  if (channel == FAN_A) {
+    endPauseShowAlive();
+  }
+}
+
+// Tach windows (fan A only) are needed only while the PWM switches the fan supply; a new duty cycle closes an open window
+void updateTachWindow() {
+  #ifdef FAN_TACH
+    FAN_SCHEDULER.cancelTask(& TACH_MEASURE_TASK);
+    FAN_SCHEDULER.cancelTask(& TACH_WINDOW);
+    tachCounting(false);
+    if (logicalIO()->isPwmActive(FAN_A)) {
+      FAN_SCHEDULER.scheduleTask(& TACH_WINDOW, TACH_PERIOD);
+    }
+  #endif
 }
 
-void fanOn(FanMode mode) {
-  FAN_SCHEDULER.cancelTask(& PAUSE_SHOW_ALIVE);
+// Fan B spins up from standstill DUAL_FAN_START_OFFSET after it has been requested: the inrush currents of both fans 
+// do not add up on the shared supply
+void fanSpeed(FanChannel channel, FanSpeed speed) {
+  #ifdef DUAL_FAN
+    if (channel == FAN_B) {
+      FAN_SCHEDULER.cancelTask(& FAN_B_START_TASK);
+      if (DUAL_FAN_START_OFFSET > 0 && speed != SPEED_OFF && logicalIO()->fanSpeed(FAN_B) == SPEED_OFF) {
+        FAN_B_START_TASK.speed = speed;
+        FAN_SCHEDULER.scheduleTask(& FAN_B_START_TASK, DUAL_FAN_START_OFFSET*D_1S);
+        return;
+      }
+    }
+  #endif
+  logicalIO()->fanSpeed(channel, speed);
+  if (channel == FAN_A) {
+    updateTachWindow();
+  }
+}
+
+// Duty values of the interval program apply to every channel in FAN_PROGRAM
+void programDuty(pwm_duty_t value) {
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    if (fanState[channel] == FAN_PROGRAM && logicalIO()->fanDutyValue(channel) != value) {
+      logicalIO()->fanDutyValue(channel, value);
+      if (channel == FAN_A) {
+        updateTachWindow();
+      }
+    }
+  }
+}
+
+bool programChannels() {
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    if (fanState[channel] == FAN_PROGRAM) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The channel has just entered FAN_PROGRAM: (re-)starts the program, or joins it if another channel runs it already
+void startProgram(FanChannel channel) {
+  #ifdef INTERVAL_PROGRAM
+    if (channel == FAN_A) {
+      endPauseShowAlive();
+    }
+    endBootBlink();
+    animateSpeedTransition();
+    if (FAN_SCHEDULER.taskForGroup(PROGRAM_GROUP) == NULL) {
+      intervalProgramStart();
+      FAN_SCHEDULER.scheduleTaskNow(& PROGRAM_TASK);
+    }
+    programDuty(intervalProgramDuty());
+  #endif
+}
+
+// The channel has just left FAN_PROGRAM
+void endProgram() {
+  #ifdef INTERVAL_PROGRAM
+    if (! programChannels()) {
+      FAN_SCHEDULER.cancelTask(& PROGRAM_TASK);
+    }
+  #endif
+}
+
+void fanOn(FanChannel channel, FanMode mode) {
+  if (channel == FAN_A) {
+    endPauseShowAlive();
+  }
+  endBootBlink();
   animateSpeedTransition();
   if (mode == MODE_CONTINUOUS) {
-    logicalIO()->fanSpeed(mapToFanSpeed(logicalIO()->fanIntensity()));
+    fanSpeed(channel, mapToFanSpeed(logicalIO()->fanIntensity()));
   } else { // mode == MODE_INTERVAL
-    logicalIO()->fanSpeed(SPEED_FULL);
+    fanSpeed(channel, SPEED_FULL);
   }
 }
 
-void fanOff() {
+void fanOff(FanChannel channel) {
   animateSpeedTransition();
-  logicalIO()->fanSpeed(SPEED_OFF);
+  fanSpeed(channel, SPEED_OFF);
 }
 
-void handleStateTransition(Event event) {
+void handleStateTransition(FanChannel channel, Event event) {
   if (event == EVENT_NONE) {
     return;
   }
+  ISR_STATS_ENTER(ISR_STATS_TRANSITION);
   #ifdef VERBOSE
-    FanState beforeState = fanState;
+    FanState beforeState = fanState[channel];
   #endif
   
-  switch(fanState) {
+  switch(fanState[channel]) {
     
     case FAN_OFF:
       switch(event) {
         case MODE_CHANGED: 
           if (logicalIO()->fanMode() == MODE_CONTINUOUS) {
-            fanState = FAN_ON;
-            fanOn(MODE_CONTINUOUS);
+            fanState[channel] = FAN_ON;
+            fanOn(channel, MODE_CONTINUOUS);
+          } else if (logicalIO()->fanMode() == MODE_INTERVAL && intervalProgramValid()) {
+            fanState[channel] = FAN_PROGRAM;
+            startProgram(channel);
           } else if (logicalIO()->fanMode() == MODE_INTERVAL) {
-            fanState = FAN_PAUSING;
-            startIntervalModeNow(); // ==> Task will turn fan ON first, PAUSE phase follows later
+            fanState[channel] = FAN_PAUSING;
+            startIntervalModeNow(channel); // ==> Task will turn fan ON first, PAUSE phase follows later
           }
           break;
           
@@ -228,32 +619,38 @@ void handleStateTransition(Event event) {
       switch(event) {
         case MODE_CHANGED: 
           if (logicalIO()->fanMode() == MODE_CONTINUOUS) {
-            endIntervalMode();
-            fanOn(MODE_CONTINUOUS);
+            endIntervalMode(channel);
+            fanOn(channel, MODE_CONTINUOUS);
+          } else if (logicalIO()->fanMode() == MODE_INTERVAL && intervalProgramValid()) {
+            endIntervalMode(channel);
+            fanState[channel] = FAN_PROGRAM;
+            startProgram(channel);
           } else if (logicalIO()->fanMode() == MODE_INTERVAL) {
-            fanState = FAN_PAUSING;
-            startIntervalModeNow(); // ==> Task will turn fan ON first, PAUSE phase follows later
+            fanState[channel] = FAN_PAUSING;
+            startIntervalModeNow(channel); // ==> Task will turn fan ON first, PAUSE phase follows later
           } else { // newMode == MODE_OFF
-            endIntervalMode();
-            fanState = FAN_OFF;
-            fanOff();
+            endIntervalMode(channel);
+            fanState[channel] = FAN_OFF;
+            fanOff(channel);
           }
           break;
           
         case INTENSITY_CHANGED: 
           if (logicalIO()->fanMode() == MODE_CONTINUOUS) {
             animateSpeedTransition();
-            logicalIO()->fanSpeed(mapToFanSpeed(logicalIO()->fanIntensity()));
+            fanSpeed(channel, mapToFanSpeed(logicalIO()->fanIntensity()));
           } else if (logicalIO()->fanMode() == MODE_INTERVAL) {
-            updateIntervalPhaseSwitcherPause();
+            updateIntervalPhaseSwitcherPause(channel);
             animateIntensityChange();
           }
           break;
 
         case INTERVAL_PHASE_ENDED:
-          fanState = FAN_PAUSING;
-          fanOff();
-          FAN_SCHEDULER.scheduleTask(& PAUSE_SHOW_ALIVE, PAUSE_SHOW_ALIVE.offDuration());  // blink for the first time after offDuration
+          fanState[channel] = FAN_PAUSING;
+          fanOff(channel);
+          if (channel == FAN_A) {
+            startPauseShowAlive();
+          }
           break;
           
         default:
@@ -265,48 +662,107 @@ void handleStateTransition(Event event) {
       switch(event) {
         case MODE_CHANGED:
           if (logicalIO()->fanMode() == MODE_OFF) {
-            endIntervalMode();
-            fanState = FAN_OFF;
+            endIntervalMode(channel);
+            fanState[channel] = FAN_OFF;
           } else if (logicalIO()->fanMode() == MODE_CONTINUOUS) {
-            endIntervalMode();
-            fanState = FAN_ON;
-            fanOn(MODE_CONTINUOUS);
+            endIntervalMode(channel);
+            fanState[channel] = FAN_ON;
+            fanOn(channel, MODE_CONTINUOUS);
           }
           break;
           
         case INTENSITY_CHANGED: 
           {
-            SDuration originalDelay = INTERVAL_PHASE_SWITCHER.originalDelay();
-            SDuration waited = originalDelay - (INTERVAL_PHASE_SWITCHER.dueTime() - now());
-            updateIntervalPhaseSwitcherPause();
+            SDuration originalDelay = INTERVAL_PHASE_SWITCHER[channel].originalDelay();
+            SDuration waited = originalDelay - (INTERVAL_PHASE_SWITCHER[channel].dueTime() - now());
+            updateIntervalPhaseSwitcherPause(channel);
             animateIntensityChange();
-            if (waited > INTERVAL_PHASE_SWITCHER.offDuration()) { // pause is over
-              FAN_SCHEDULER.rescheduleTask(& INTERVAL_PHASE_SWITCHER, 0); // = now
+            if (waited > INTERVAL_PHASE_SWITCHER[channel].offDuration()) { // pause is over
+              FAN_SCHEDULER.rescheduleTask(& INTERVAL_PHASE_SWITCHER[channel], 0); // = now
             } else {
-              FAN_SCHEDULER.rescheduleTask(& INTERVAL_PHASE_SWITCHER, INTERVAL_PHASE_SWITCHER.offDuration() - waited);
+              FAN_SCHEDULER.rescheduleTask(& INTERVAL_PHASE_SWITCHER[channel], INTERVAL_PHASE_SWITCHER[channel].offDuration() - waited);
             }
           }
           break;
 
         case INTERVAL_PHASE_ENDED:
-          fanState = FAN_ON;
-          fanOn(MODE_INTERVAL);
+          fanState[channel] = FAN_ON;
+          fanOn(channel, MODE_INTERVAL);
           break;
           
         default: 
           break;
       }
       break;
+
+    case FAN_PROGRAM:
+      switch(event) {
+        case MODE_CHANGED:
+          if (logicalIO()->fanMode() == MODE_OFF) {
+            fanState[channel] = FAN_OFF;
+            endProgram();
+            fanOff(channel);
+          } else if (logicalIO()->fanMode() == MODE_CONTINUOUS) {
+            fanState[channel] = FAN_ON;
+            endProgram();
+            fanOn(channel, MODE_CONTINUOUS);
+          }
+          break;
+
+        case INTENSITY_CHANGED:
+          // the program reads the intensity at its next OP_JUMP_INTENSITY
+          animateIntensityChange();
+          break;
+
+        default:
+          break;
+      }
+      break;
   }
   
-  #ifdef VERBOSE
-    Serial.print("State ");
-    Serial.print(fanStateName(beforeState));
-    Serial.print(" -- [");
-    Serial.print(eventName(event));
-    Serial.print("] --> State ");
-    Serial.println(fanStateName(fanState));
-    Serial.flush();
+  TRACE(TRACE_TRANSITION, (channel << 4) | fanState[channel], (beforeState << 8) | event);
+  scheduleTelemetryTask();
+  ISR_STATS_EXIT(ISR_STATS_TRANSITION);
+}
+
+// Mode and intensity switches apply to all fan channels
+void handleStateTransition(Event event) {
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    handleStateTransition(channel, event);
+  }
+}
+
+FanState getFanState(FanChannel channel) {
+  return fanState[channel];
+}
+
+uint16_t getFanRpm() {
+  return lastFanRpm;
+}
+
+// Also written by the I2C ISR
+IntervalDurations getIntervalDurations() {
+  IntervalDurations copy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    copy = intervals;
+  }
+  return copy;
+}
+
+// ISR-safe: applied by the state machine like an intensity change (a running pause adapts at once)
+void setIntervalDurations(IntervalDurations durations) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    intervals = durations;
+  }
+  scheduleIntensityChangedTask();
+}
+
+// ISR-safe: the clock task applies the time and selects the profile that is due
+void setDayClock(time32_s_t weekTime) {
+  #ifdef DAY_CLOCK
+    dayClockSet(weekTime);
+    FAN_SCHEDULER.cancelTask(& DAY_CLOCK_TASK);
+    FAN_SCHEDULER.scheduleTaskNow(& DAY_CLOCK_TASK);
   #endif
 }
 
@@ -315,13 +771,25 @@ void initFanControl() {
   logicalIO()->modeChangedHandler = scheduleModeChangeTask;
   logicalIO()->intensityChangedHandler = scheduleIntensityChangedTask; 
 
-  SPEED_TRANSITION_BLINKER.name("Speed");
-  SPEED_TRANSITION_BLINKER.delays(D_500MS, D_500MS);
-  INTENTITY_CHANGED_FEEDBACK_BLINKER.name("Intensity");
-  INTENTITY_CHANGED_FEEDBACK_BLINKER.delays(D_250MS, D_250MS);
-  PAUSE_SHOW_ALIVE.name("Blip");
-  PAUSE_SHOW_ALIVE.delays(D_250MS, INTERVAL_PAUSE_BLIP_PERIOD*D_1S);  // will be stopped at pause end
-  updateIntervalPhaseSwitcherPause();
+  #ifdef STATUS_LED
+    SPEED_TRANSITION_BLINKER.name("Speed");
+    SPEED_TRANSITION_BLINKER.delays(D_500MS, D_500MS);
+    INTENTITY_CHANGED_FEEDBACK_BLINKER.name("Intensity");
+    INTENTITY_CHANGED_FEEDBACK_BLINKER.delays(D_250MS, D_250MS);
+    PAUSE_SHOW_ALIVE.name("Blip");
+    PAUSE_SHOW_ALIVE.delays(D_250MS, INTERVAL_PAUSE_BLIP_PERIOD*D_1S);  // will be stopped at pause end
+  #endif
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    updateIntervalPhaseSwitcherPause(channel);
+  }
+  #ifdef FAN_TACH
+    TACH_WINDOW.delays(TACH_SETTLE + TACH_MEASURE, TACH_PERIOD);
+  #endif
+  #ifdef STATUS_LED
+    BOOT_BLINKER.name("Boot");
+    BOOT_BLINKER.delays(3*D_500MS, D_500MS);
+    FAN_SCHEDULER.scheduleTaskNow(& BOOT_BLINKER);  // superseded by the speed-transition animation if the fan starts (see fanOn())
+  #endif
 
   logicalIO()->init();  // this causes the first tasks to be created for intensity and mode change
 }
@@ -2,6 +2,7 @@
   #define FAN_CONTROL_H_INCLUDED
   
   #include <io_util.h>
+  #include "phys_io.h"
   
   // const duration16_s_t INTERVAL_FAN_ON_DURATION = 300;         // [s]
   // const duration16_s_t INTERVAL_PAUSE_SHORT_DURATION = 60;     // [s]
@@ -12,15 +13,31 @@
   const duration16_s_t INTERVAL_PAUSE_SHORT_DURATION = 15;     // [s]
   const duration16_s_t INTERVAL_PAUSE_MEDIUM_DURATION = 30;   // [s]
   const duration16_s_t INTERVAL_PAUSE_LONG_DURATION = 60;    // [s]
+  const duration16_s_t INTERVAL_MAX_DURATION = INT16_MAX;    // [s] longest fan-on or pause duration (see IntervalDurations)
   const duration16_s_t INTERVAL_PAUSE_BLIP_PERIOD = 10;    // [s]
+  const duration16_s_t DUAL_FAN_START_OFFSET = 2;         // [s] DUAL_FAN: fan B spins up this much after fan A; 0 --> together
   void controllerLoop();
   
   //
   // CONTROLLER STATES
   //
-  typedef enum  {FAN_OFF, FAN_ON, FAN_PAUSING} FanState;
+  typedef enum  {FAN_OFF, FAN_ON, FAN_PAUSING, FAN_PROGRAM} FanState;   // FAN_PROGRAM: INTERVAL_PROGRAM only
   typedef enum  {EVENT_NONE, MODE_CHANGED, INTENSITY_CHANGED, INTERVAL_PHASE_ENDED} Event;
 
+  // Interval durations [s]; initially the constants above. Changes are applied like an intensity change.
+  typedef struct {
+    duration16_s_t fanOn;
+    duration16_s_t pauseShort;    // INTENSITY_HIGH
+    duration16_s_t pauseMedium;   // INTENSITY_MEDIUM
+    duration16_s_t pauseLong;     // INTENSITY_LOW
+  } IntervalDurations;
+
   void initFanControl();
+  
+  FanState getFanState(FanChannel channel);
+  uint16_t getFanRpm();    // [RPM] of fan A, last tach window; 0 before the first measurement or without FAN_TACH
+  IntervalDurations getIntervalDurations();
+  void setIntervalDurations(IntervalDurations durations);
+  void setDayClock(time32_s_t weekTime);   // [s] since Monday 00:00 (DAY_CLOCK, see day_clock.h)
 
 #endif
@@ -6,32 +6,35 @@
 #include "phys_io.h"
 #include "log_io.h"
 #include "fan_control.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "console.h"
+#include "i2c_slave.h"
 
 //
 //  #define VERBOSE --> see phys_io.h
+//  #define CONSOLE --> see phys_io.h
 //  #define SCHEDULER_VERBOSE --> scheduler.h
 
 void setup() {
   #ifdef VERBOSE
     // Setup Serial Monitor
-    Serial.begin(38400);
-    
-    Serial.print("F_CPU: ");
-    Serial.println(F_CPU);
-    Serial.print("PWM counter max: ");
-    Serial.println(TIMER1_COUNT_TO);
-    Serial.print("Fan out low threshold: ");
-    Serial.println(FAN_LOW_THRESHOLD_DUTY_VALUE);
-    Serial.flush();
+    Serial.begin(38400);   // binary trace stream --> decode with tools/trace_decode.py
+    TRACE(TRACE_BOOT, 0, F_CPU / 1000);
     #define USART0_SERIAL USART0_ON
   #else
     #define USART0_SERIAL USART0_OFF
   #endif
+  #ifdef CONSOLE
+    Serial.begin(CONSOLE_BAUD_RATE);   // text commands --> see console.h
+  #endif
 
   configPhysicalIO();
-  turnOnLED(STATUS_LED_OUT_PIN, 1500);
-  delay(500);
+  configIsrStats();
+  configI2cSlave();
 
+  // Fast boot: the fan state is restored by the first scheduler run (e.g. after a brown-out), the boot animation 
+  // runs as a task. Boot-to-PWM time = RESET pin rising edge --> first edge on FAN_PWM_OUT_PIN
   initFanControl();
 
   controllerLoop(); // infinite 
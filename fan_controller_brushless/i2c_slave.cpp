@@ -0,0 +1,296 @@
+#include <avr/power.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+#include "i2c_slave.h"
+#include "log_io.h"
+#include "fan_control.h"
+#include "day_clock.h"
+
+#ifdef I2C_SLAVE
+
+uint8_t i2cRegisters[I2C_REGISTERS];  // register image; captured at each address match, then written by the master
+uint8_t i2cPointer = 0;               // register of the next data byte
+bool i2cPointerPending = false;       // true: the next byte received is the register pointer
+volatile bool i2cBusy = false;
+
+//
+// PROTOCOL (bus independent)
+//
+void i2cPut16(uint8_t reg, uint16_t value) {
+  i2cRegisters[reg] = value;
+  i2cRegisters[reg + 1] = value >> 8;
+}
+
+uint16_t i2cGet16(uint8_t reg) {
+  return i2cRegisters[reg] | (i2cRegisters[reg + 1] << 8);
+}
+
+void i2cPut32(uint8_t reg, uint32_t value) {
+  i2cPut16(reg, value);
+  i2cPut16(reg + 2, value >> 16);
+}
+
+uint32_t i2cGet32(uint8_t reg) {
+  return i2cGet16(reg) | ((uint32_t) i2cGet16(reg + 2) << 16);
+}
+
+void i2cCapture() {
+  LogicalIOModel* io = logicalIO();
+  IntervalDurations d = getIntervalDurations();
+  i2cRegisters[I2C_REG_ID] = I2C_SLAVE_ID;
+  i2cRegisters[I2C_REG_MODE] = io->fanModeOverride();
+  i2cRegisters[I2C_REG_INTENSITY] = io->fanIntensityOverride();
+  i2cRegisters[I2C_REG_DUTY] = io->fanDutyOverride();
+  i2cPut16(I2C_REG_FAN_ON, d.fanOn);
+  i2cPut16(I2C_REG_PAUSE_SHORT, d.pauseShort);
+  i2cPut16(I2C_REG_PAUSE_MEDIUM, d.pauseMedium);
+  i2cPut16(I2C_REG_PAUSE_LONG, d.pauseLong);
+  i2cRegisters[I2C_REG_STATE] = getFanState(FAN_A);
+  i2cRegisters[I2C_REG_DUTY_A] = io->fanDutyValue(FAN_A);
+  #ifdef DUAL_FAN
+    i2cRegisters[I2C_REG_STATE] |= getFanState(FAN_B) << 4;
+    i2cRegisters[I2C_REG_DUTY_B] = io->fanDutyValue(FAN_B);
+  #else
+    i2cRegisters[I2C_REG_DUTY_B] = 0;
+  #endif
+  i2cPut16(I2C_REG_RPM, getFanRpm());
+  i2cPut32(I2C_REG_CLOCK, dayClockValid() ? dayClockTime() : UINT32_MAX);
+}
+
+// Writes to read-only registers and out-of-range values are ignored
+void i2cApply(uint8_t reg) {
+  uint8_t value = i2cRegisters[reg];
+  IntervalDurations d = getIntervalDurations();
+  switch (reg) {
+    case I2C_REG_MODE:
+      if (value <= MODE_INTERVAL) {
+        logicalIO()->overrideFanMode((FanMode) value);
+      }
+      return;
+    case I2C_REG_INTENSITY:
+      if (value <= INTENSITY_HIGH) {
+        logicalIO()->overrideFanIntensity((FanIntensity) value);
+      }
+      return;
+    case I2C_REG_DUTY:
+      logicalIO()->overrideDutyValue(value);
+      return;
+    case I2C_REG_CLOCK + 3:
+      if (i2cGet32(I2C_REG_CLOCK) < DAY_CLOCK_WEEK_S) {
+        setDayClock(i2cGet32(I2C_REG_CLOCK));
+      }
+      return;
+    case I2C_REG_FAN_ON + 1:        d.fanOn = i2cGet16(I2C_REG_FAN_ON); break;
+    case I2C_REG_PAUSE_SHORT + 1:   d.pauseShort = i2cGet16(I2C_REG_PAUSE_SHORT); break;
+    case I2C_REG_PAUSE_MEDIUM + 1:  d.pauseMedium = i2cGet16(I2C_REG_PAUSE_MEDIUM); break;
+    case I2C_REG_PAUSE_LONG + 1:    d.pauseLong = i2cGet16(I2C_REG_PAUSE_LONG); break;
+    default:
+      return;
+  }
+  uint16_t seconds = i2cGet16(reg - 1);
+  if (seconds > 0 && seconds <= (uint16_t) INTERVAL_MAX_DURATION) {   // others are ignored
+    setIntervalDurations(d);
+  }
+}
+
+void i2cSlaveAddressed(bool read) {
+  i2cBusy = true;
+  i2cPointerPending = ! read;
+  i2cCapture();
+}
+
+void i2cSlaveReceive(uint8_t value) {
+  if (i2cPointerPending) {
+    i2cPointer = value;
+    i2cPointerPending = false;
+  } else if (i2cPointer < I2C_REGISTERS) {
+    i2cRegisters[i2cPointer] = value;
+    i2cApply(i2cPointer++);
+  }
+}
+
+uint8_t i2cSlaveTransmit() {
+  return i2cPointer < I2C_REGISTERS ? i2cRegisters[i2cPointer++] : 0xFF;
+}
+
+void i2cSlaveStop() {
+  i2cBusy = false;
+}
+
+#if defined(__AVR_ATmega328P__)
+  //
+  // TWI
+  //
+  const uint8_t TWI_ACK = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);  // clears TWINT => releases SCL
+
+  void configI2cSlave() {
+    power_twi_enable();
+    TWAR = I2C_SLAVE_ADDRESS << 1;    // general call disabled
+    TWCR = _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  }
+
+  bool i2cSlaveIdle() {
+    return ! i2cBusy;
+  }
+
+  // The address match also wakes the MCU from POWER-DOWN
+  ISR (TWI_vect) {
+    switch (TW_STATUS) {
+      case TW_SR_SLA_ACK:         // own address + W
+      case TW_SR_ARB_LOST_SLA_ACK:
+        i2cSlaveAddressed(false);
+        break;
+      case TW_SR_DATA_ACK:
+        i2cSlaveReceive(TWDR);
+        break;
+      case TW_ST_SLA_ACK:         // own address + R
+      case TW_ST_ARB_LOST_SLA_ACK:
+        i2cSlaveAddressed(true);
+        TWDR = i2cSlaveTransmit();
+        break;
+      case TW_ST_DATA_ACK:
+        TWDR = i2cSlaveTransmit();
+        break;
+      case TW_SR_STOP:            // STOP or repeated START
+      case TW_ST_DATA_NACK:       // the master has read enough
+      case TW_ST_LAST_DATA:
+        i2cSlaveStop();
+        break;
+      case TW_BUS_ERROR:          // illegal START or STOP => release the bus
+        i2cSlaveStop();
+        TWCR = TWI_ACK | _BV(TWSTO);
+        return;
+      default:
+        break;
+    }
+    TWCR = TWI_ACK;
+  }
+
+#elif defined(__AVR_ATtiny85__)
+  //
+  // USI (two-wire mode, after Atmel application note AVR312)
+  //
+  const uint8_t USI_SDA = PB0;
+  const uint8_t USI_SCL = PB2;
+
+  typedef enum {
+    USI_CHECK_ADDRESS, USI_SEND_DATA, USI_REQUEST_ACK, USI_CHECK_ACK, USI_REQUEST_DATA, USI_GET_DATA
+  } UsiState;
+  volatile UsiState usiState = USI_CHECK_ADDRESS;
+
+  // USISR: clears the flags except the start condition (the start ISR clears that one); 4-bit counter start value:
+  // 0 --> 16 clock edges = 1 byte, 14 --> 2 edges = 1 (N)ACK bit
+  const uint8_t USI_CLEAR_FLAGS = _BV(USIOIF) | _BV(USIPF) | _BV(USIDC);
+  const uint8_t USI_COUNT_BYTE = 0x00;
+  const uint8_t USI_COUNT_BIT = 0x0E;
+
+  // wait for a START condition; SCL is not held
+  void usiListen() {
+    USICR = _BV(USISIE) | _BV(USIWM1) | _BV(USICS1);
+    USISR = USI_CLEAR_FLAGS;
+  }
+
+  void usiSendAck() {
+    USIDR = 0;
+    DDRB |= _BV(USI_SDA);
+    USISR = USI_CLEAR_FLAGS | USI_COUNT_BIT;
+  }
+
+  void usiReadAck() {
+    DDRB &= ~ _BV(USI_SDA);
+    USIDR = 0;
+    USISR = USI_CLEAR_FLAGS | USI_COUNT_BIT;
+  }
+
+  void usiSendByte() {
+    DDRB |= _BV(USI_SDA);
+    USISR = USI_CLEAR_FLAGS | USI_COUNT_BYTE;
+  }
+
+  void usiReadByte() {
+    DDRB &= ~ _BV(USI_SDA);
+    USISR = USI_CLEAR_FLAGS | USI_COUNT_BYTE;
+  }
+
+  void configI2cSlave() {
+    power_usi_enable();
+    PORTB |= _BV(USI_SCL) | _BV(USI_SDA);   // released lines: the output latch must be HIGH
+    DDRB |= _BV(USI_SCL);
+    DDRB &= ~ _BV(USI_SDA);
+    usiListen();
+  }
+
+  // The USI has no STOP interrupt: the STOP flag is evaluated before each sleep
+  bool i2cSlaveIdle() {
+    if (i2cBusy && bit_is_set(USISR, USIPF)) {
+      i2cSlaveStop();
+    }
+    return ! i2cBusy;
+  }
+
+  // Wakes the MCU from POWER-DOWN; the USI holds SCL low until the start condition flag is cleared
+  ISR (USI_START_vect) {
+    usiState = USI_CHECK_ADDRESS;
+    DDRB &= ~ _BV(USI_SDA);
+    // the START condition is complete once SCL is low (a few µs), unless a STOP follows at once
+    while (bit_is_set(PINB, USI_SCL) && bit_is_clear(PINB, USI_SDA)) { }
+    if (bit_is_clear(PINB, USI_SDA)) {
+      // hold SCL low after each counter overflow until the overflow ISR has set up the next bit(s)
+      USICR = _BV(USISIE) | _BV(USIOIE) | _BV(USIWM1) | _BV(USIWM0) | _BV(USICS1);
+    } else {
+      USICR = _BV(USISIE) | _BV(USIWM1) | _BV(USICS1);
+    }
+    USISR = _BV(USISIF) | USI_CLEAR_FLAGS | USI_COUNT_BYTE;
+  }
+
+  ISR (USI_OVF_vect) {
+    switch (usiState) {
+      case USI_CHECK_ADDRESS:
+        if ((USIDR >> 1) == I2C_SLAVE_ADDRESS) {
+          bool read = USIDR & 1;
+          i2cSlaveAddressed(read);
+          usiState = read ? USI_SEND_DATA : USI_REQUEST_DATA;
+          usiSendAck();
+        } else {
+          usiListen();
+        }
+        break;
+
+      case USI_CHECK_ACK:
+        if (USIDR != 0) {       // NACK: the master has read enough
+          i2cSlaveStop();
+          usiListen();
+          break;
+        }
+        // fall through: ACK => next byte
+      case USI_SEND_DATA:
+        USIDR = i2cSlaveTransmit();
+        usiState = USI_REQUEST_ACK;
+        usiSendByte();
+        break;
+
+      case USI_REQUEST_ACK:
+        usiState = USI_CHECK_ACK;
+        usiReadAck();
+        break;
+
+      case USI_REQUEST_DATA:
+        usiState = USI_GET_DATA;
+        usiReadByte();
+        break;
+
+      case USI_GET_DATA:
+        i2cSlaveReceive(USIDR);
+        usiState = USI_REQUEST_DATA;
+        usiSendAck();
+        break;
+    }
+  }
+#endif
+
+#else
+
+void configI2cSlave() { }
+bool i2cSlaveIdle() { return true; }
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef I2C_SLAVE_H_INCLUDED
+  #define I2C_SLAVE_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <io_util.h>
+  #include "phys_io.h"
+
+  //
+  // I2C slave for host-driven setpoints (#define I2C_SLAVE --> see phys_io.h): TWI on the ATmega328P (SDA = PC4,
+  // SCL = PC5), USI on the ATtiny85 (SDA = PB0, SCL = PB2).
+  // ATtiny85: the bus takes the pins of the status LED and of the mode switch => no LED (and no LED animation tasks, 
+  // see STATUS_LED); the mode is INTERVAL until the master writes I2C_REG_MODE.
+  //
+  // External pull-ups on SDA and SCL are required.
+  // Transactions: START, address + W, register, data... (auto-increment) | START, address + R, data...
+  // A read starts at the register of the last write transaction (repeated START in between is fine).
+  // 16/32-bit registers are little endian; a write takes effect with its high byte, a read returns a consistent value
+  // (the read-only registers are captured at the address match).
+  //
+  // Every register write goes straight into the event path of the state machine: mode and intensity like a switch
+  // change, duty and interval durations as an intensity change (see scheduleIntensityChangedTask()).
+  //
+  // Clock stretching: the hardware holds SCL low from each byte until its ISR has run (a few µs of register
+  // copying, no busy waits); a switch change delays it by INPUT_DEBOUNCE_DURATION_MS. ATmega328P TWI: slave
+  // operation requires a CPU clock of at least 16 x SCL, incl. the scaled-down clock in IDLE sleep (2 MHz => 100 kHz).
+  //
+  const uint8_t I2C_SLAVE_ADDRESS = 0x2C;     // 7 bit
+  const uint8_t I2C_SLAVE_ID = 0xF5;          // value of I2C_REG_ID
+
+  typedef enum {
+    I2C_REG_ID,               // r   I2C_SLAVE_ID
+    I2C_REG_MODE,             // rw  FanMode; MODE_UNDEF (0) --> follow the switch
+    I2C_REG_INTENSITY,        // rw  FanIntensity; INTENSITY_UNDEF (0) --> follow the switch
+    I2C_REG_DUTY,             // rw  raw duty value of running fans; 0 --> calibrated airflow (see fan_calibration.h)
+    I2C_REG_FAN_ON,           // rw  uint16 [s] interval fan-on duration, 1..32767 (others are ignored)
+    I2C_REG_PAUSE_SHORT = 6,  // rw  uint16 [s] interval pause @ INTENSITY_HIGH, 1..32767
+    I2C_REG_PAUSE_MEDIUM = 8, // rw  uint16 [s] interval pause @ INTENSITY_MEDIUM, 1..32767
+    I2C_REG_PAUSE_LONG = 10,  // rw  uint16 [s] interval pause @ INTENSITY_LOW, 1..32767
+    I2C_REG_STATE = 12,       // r   FanState of fan A | (FanState of fan B << 4)
+    I2C_REG_DUTY_A,           // r   current duty value of fan A
+    I2C_REG_DUTY_B,           // r   current duty value of fan B (DUAL_FAN)
+    I2C_REG_RPM,              // r   uint16 [RPM] fan A, last tach window (FAN_TACH)
+    I2C_REG_CLOCK = 17,       // rw  uint32 [s] day clock since Monday 00:00, 0xFFFFFFFF: unset (DAY_CLOCK)
+    I2C_REGISTERS = 21
+  } I2cRegister;
+
+  #if defined(I2C_SLAVE) && defined(LED_TELEMETRY) && defined(__AVR_ATtiny85__)
+    #error("I2C_SLAVE and LED_TELEMETRY both use PB0 of the ATtiny85")
+  #endif
+
+  void configI2cSlave();
+
+  // Returns true if no transaction is in progress (=> the MCU may sleep in POWER-DOWN; the address match or the
+  // start condition wakes it)
+  bool i2cSlaveIdle();
+
+  // Bus-independent protocol layer, invoked by the TWI / USI ISRs (or by a simulated bus master):
+  void i2cSlaveAddressed(bool read);    // own address received
+  void i2cSlaveReceive(uint8_t value);  // data byte from the master
+  uint8_t i2cSlaveTransmit();           // next data byte for the master
+  void i2cSlaveStop();                  // end of the transaction
+
+#endif
@@ -0,0 +1,136 @@
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "interval_program.h"
+#include "trace.h"
+
+#ifdef INTERVAL_PROGRAM
+
+const uint8_t* const PROGRAM_HEADER = (const uint8_t*) INTERVAL_PROGRAM_ADDRESS;
+const uint8_t* const PROGRAM_CODE = PROGRAM_HEADER + 3;
+
+uint8_t programLength = 0;      // [bytes] of code
+uint8_t programCounter = 0;     // code offset of the next instruction
+uint8_t programLoopCount = 0;   // completed runs of the current LOOP block
+pwm_duty_t programDutyValue = PWM_DUTY_MIN;
+
+// Current ramp (OP_RAMP); rampRemaining == 0: no ramp
+pwm_duty_t rampTarget;
+duration16_s_t rampRemaining = 0;   // [s]
+
+inline uint8_t fetch() {
+  return programCounter < programLength ? eeprom_read_byte(PROGRAM_CODE + programCounter++) : OP_END;
+}
+
+inline uint16_t fetchWord() {
+  uint16_t low = fetch();
+  return low | (fetch() << 8);
+}
+
+// Below the stall threshold, a fan would not start
+pwm_duty_t runningDuty(pwm_duty_t value) {
+  return value > PWM_DUTY_MIN && value < FAN_LOW_THRESHOLD_DUTY_VALUE ? FAN_LOW_THRESHOLD_DUTY_VALUE : value;
+}
+
+bool intervalProgramValid() {
+  if (eeprom_read_byte(PROGRAM_HEADER) != INTERVAL_PROGRAM_MAGIC) {
+    return false;
+  }
+  uint8_t length = eeprom_read_byte(PROGRAM_HEADER + 1);
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    crc = _crc8_ccitt_update(crc, eeprom_read_byte(PROGRAM_CODE + i));
+  }
+  return length > 0 && crc == eeprom_read_byte(PROGRAM_HEADER + 2);
+}
+
+void intervalProgramStart() {
+  programLength = eeprom_read_byte(PROGRAM_HEADER + 1);
+  programCounter = 0;
+  programLoopCount = 0;
+  rampRemaining = 0;
+  programDutyValue = PWM_DUTY_MIN;
+}
+
+duration16_s_t intervalProgramStep(FanIntensity intensity) {
+  if (rampRemaining > 0) {
+    // linear in the remaining time => ends exactly on the target
+    programDutyValue += ((int16_t) rampTarget - programDutyValue) / (int16_t) rampRemaining;
+    programDutyValue = runningDuty(programDutyValue);
+    if (--rampRemaining > 0) {
+      return 1;
+    }
+  }
+
+  for (uint8_t executed = 0; executed < INTERVAL_PROGRAM_MAX_INSTRUCTIONS; executed++) {
+    uint8_t address = programCounter;
+    uint8_t opcode = fetch();
+    TRACE(TRACE_PROGRAM, opcode, (address << 8) | programDutyValue);
+    switch (opcode) {
+      case OP_DUTY:
+        programDutyValue = runningDuty(fetch());
+        break;
+
+      case OP_RAMP:
+        rampTarget = runningDuty(fetch());
+        rampRemaining = fetch();
+        if (rampRemaining > 0) {
+          return 1;
+        }
+        programDutyValue = rampTarget;
+        break;
+
+      case OP_HOLD:
+        {
+          duration16_s_t seconds = fetchWord();
+          if (seconds > 0) {
+            return seconds;
+          }
+        }
+        break;
+
+      case OP_LOOP:
+        {
+          uint8_t count = fetch();
+          uint8_t target = fetch();
+          if (count == 0 || ++programLoopCount < count) {
+            programCounter = target;
+          } else {
+            programLoopCount = 0;
+          }
+        }
+        break;
+
+      case OP_JUMP_INTENSITY:
+        {
+          uint8_t low = fetch();
+          uint8_t medium = fetch();
+          uint8_t high = fetch();
+          switch (intensity) {
+            case INTENSITY_HIGH:    programCounter = high; break;
+            case INTENSITY_MEDIUM:  programCounter = medium; break;
+            default:                programCounter = low; break;
+          }
+        }
+        break;
+
+      default:  // OP_END, end of code, unknown opcode
+        programDutyValue = PWM_DUTY_MIN;
+        return 0;
+    }
+  }
+  programDutyValue = PWM_DUTY_MIN;  // no wait within INTERVAL_PROGRAM_MAX_INSTRUCTIONS
+  return 0;
+}
+
+pwm_duty_t intervalProgramDuty() {
+  return programDutyValue;
+}
+
+#else
+
+bool intervalProgramValid() { return false; }
+void intervalProgramStart() { }
+duration16_s_t intervalProgramStep(FanIntensity intensity) { return 0; }
+pwm_duty_t intervalProgramDuty() { return PWM_DUTY_MIN; }
+
+#endif
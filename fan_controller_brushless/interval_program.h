@@ -0,0 +1,47 @@
+#ifndef INTERVAL_PROGRAM_H_INCLUDED
+  #define INTERVAL_PROGRAM_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <io_util.h>
+  #include "log_io.h"
+
+  //
+  // Programmable interval sequences (#define INTERVAL_PROGRAM --> see phys_io.h).
+  //
+  // With a valid program in the EEPROM, mode INTERVAL runs the program instead of the fixed on / pause pattern (see
+  // FAN_PROGRAM in fan_control.cpp); it is loaded without reflashing the firmware, e.g. with
+  //   tools/interval_program.py purge.txt -o purge.hex && avrdude ... -U eeprom:w:purge.hex:i
+  //
+  // EEPROM at INTERVAL_PROGRAM_ADDRESS: INTERVAL_PROGRAM_MAGIC, code length, CRC-8 (polynomial 0x07) of the code, code.
+  // Code: 1-byte opcode followed by its operands [bytes]; addresses are 1-byte code offsets.
+  // Operand widths must match OPCODES in tools/interval_program.py.
+  //
+  typedef enum {
+    OP_END,             //                                stops the program with the fans off (until the mode changes)
+    OP_DUTY,            // duty (1)                       sets the duty value at once
+    OP_RAMP,            // duty (1), seconds (1)          ramps linearly from the current duty value in 1 s steps
+    OP_HOLD,            // seconds (2, little endian)     keeps the duty value (the MCU sleeps)
+    OP_LOOP,            // count (1), address (1)         jumps back until the block has run count times (0: forever)
+    OP_JUMP_INTENSITY,  // address LOW, MEDIUM, HIGH (1 each) jumps according to the intensity switch
+    OP_CODES
+  } IntervalOpcode;
+
+  const uint16_t INTERVAL_PROGRAM_ADDRESS = 0;   // [EEPROM byte]
+  const uint8_t INTERVAL_PROGRAM_MAGIC = 0xB5;
+  // Instructions per step without a wait; a program that exceeds this (a loop without HOLD or RAMP) is stopped
+  const uint8_t INTERVAL_PROGRAM_MAX_INSTRUCTIONS = 16;
+
+  // Header and CRC of the program in the EEPROM are intact
+  bool intervalProgramValid();
+
+  // Restarts the program from its first instruction with the fans off
+  void intervalProgramStart();
+
+  // Executes the instructions up to the next wait (one loop counter: LOOPs with count > 0 must not be nested)
+  // Returns the wait [s] until the next step; 0: the program has ended
+  duration16_s_t intervalProgramStep(FanIntensity intensity);
+
+  // Duty value set by the program
+  pwm_duty_t intervalProgramDuty();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef ISR_STATS_H_INCLUDED
+  #define ISR_STATS_H_INCLUDED
+
+  #include <Arduino.h> 
+  #include <io_util.h>
+  #include "phys_io.h"
+
+  //
+  // Optional ISR duration instrumentation (#define ISR_STATS --> see phys_io.h), ATmega328P only.
+  //
+  // Entry and exit of each instrumented section are timestamped with free-running Timer2 (16 MHz / 32 = 2 µs per 
+  // tick, extended to 16 bits by its overflow interrupt). While interrupts are disabled, only one overflow can be 
+  // accounted for: a section that runs longer than 255 ticks (510 µs) with an overflow pending is counted in the last 
+  // histogram bucket and sets max to ISR_STATS_SATURATED (it is not part of count, min and average); beyond 2 overflows
+  // (~1 ms) with interrupts disabled, the duration is lost. An overflow already pending at entry is counted right there.
+  // The switch debounce (~10 ms busy wait with interrupts disabled) is not part of the instrumented sections.
+  // For sub-tick resolution, ISR_STATS_DEBUG_PIN is driven HIGH for the duration of each section --> logic analyser.
+  //
+  
+  // The watchdog ISR belongs to the scheduler library and is not instrumented
+  typedef enum {ISR_STATS_PCINT0, ISR_STATS_PCINT2, ISR_STATS_TRANSITION, ISR_STATS_VECTORS} IsrStatsVector;
+  
+  typedef uint16_t isr_ticks_t;
+  
+  const uint8_t ISR_STATS_PRESCALER = 32;              // Timer2 clock select: see configIsrStats()
+  const uint8_t ISR_STATS_TICK_US = ISR_STATS_PRESCALER * 1000000UL / F_CPU;  // [µs] Timer2 resolution
+  const isr_ticks_t ISR_STATS_SATURATED = UINT16_MAX;  // max: a section has been too long to be measured
+  const uint8_t ISR_STATS_HISTOGRAM_BUCKETS = 8;       // bucket n counts durations of [2^(n-1), 2^n) ticks, bucket 0: < 1 tick
+  #if defined(__AVR_ATmega328P__)
+    const pin_t ISR_STATS_DEBUG_PIN = 13;              // PB5 - digital out; HIGH while an instrumented section runs
+    static_assert(ISR_STATS_DEBUG_PIN >= 8 && ISR_STATS_DEBUG_PIN <= 13, "ISR_STATS_DEBUG_PIN must be on PORTB");
+    const uint8_t ISR_STATS_DEBUG_BIT = _BV(ISR_STATS_DEBUG_PIN - 8);  // digital pins 8..13 = PB0..PB5
+  #endif
+
+  typedef struct {
+    uint16_t count;
+    isr_ticks_t min;
+    isr_ticks_t max;
+    uint32_t sum;
+    uint16_t histogram[ISR_STATS_HISTOGRAM_BUCKETS];
+  } IsrStats;
+
+  #ifdef ISR_STATS
+    #if ! defined(__AVR_ATmega328P__)
+      #error("ISR_STATS requires a free Timer2 and is supported on ATmega328P only")
+    #endif
+    #define ISR_STATS_ENTER(vector) isr_ticks_t isrStatsEntry = isrStatsEnter()
+    #define ISR_STATS_EXIT(vector) isrStatsExit((vector), isrStatsEntry)
+  #else
+    #define ISR_STATS_ENTER(vector)
+    #define ISR_STATS_EXIT(vector)
+  #endif
+
+  void configIsrStats();
+  
+  isr_ticks_t isrStatsEnter();
+  void isrStatsExit(IsrStatsVector vector, isr_ticks_t entry);
+  
+  // Returns a consistent copy of the statistics of the given vector
+  IsrStats getIsrStats(IsrStatsVector vector);
+
+  // Writes the statistics of all vectors as trace records (on every mode change)
+  void reportIsrStats();
+
+#endif
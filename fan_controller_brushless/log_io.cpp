@@ -1,7 +1,13 @@
 #include "Arduino.h"
+#include <util/delay.h>
+#include <util/atomic.h>
 #include <limits.h>
 #include "log_io.h"
 #include "phys_io.h"
+#include "trace.h"
+#include "isr_stats.h"
+#include "mem_stats.h"
+#include "fan_calibration.h"
 
 // Singleton instance
 LogicalIOModel LOGICAL_IO = LogicalIOModel();
@@ -22,7 +28,11 @@ void LogicalIOModel::updateFanModeFromInputPins() {
 
   #elif defined(__AVR_ATtiny85__)
     uint8_t p1 = LOW;
-    uint8_t p2 = digitalRead(MODE_SWITCH_IN_PIN);
+    #ifdef I2C_SLAVE
+      uint8_t p2 = LOW;     // the pin is SCL => no switch: INTERVAL until the master writes I2C_REG_MODE
+    #else
+      uint8_t p2 = digitalRead(MODE_SWITCH_IN_PIN);
+    #endif
   #endif
 
   FanMode previous = mode;
@@ -34,12 +44,11 @@ void LogicalIOModel::updateFanModeFromInputPins() {
   } else {
     mode = MODE_INTERVAL;
   }
+  if (modeOverride != MODE_UNDEF) {
+    mode = modeOverride;
+  }
   if (mode != previous) {
-    #ifdef VERBOSE
-      Serial.print("Read Fan Mode: ");
-      Serial.println(mode == MODE_INTERVAL ? "INTERVAL" : (mode == MODE_CONTINUOUS ? "CONTINUOUS" :"OFF"));
-      Serial.flush();
-    #endif
+    TRACE(TRACE_MODE_READ, 0, mode);
 
     if (modeChangedHandler != NULL) modeChangedHandler();
   }
@@ -58,13 +67,33 @@ void LogicalIOModel::updateFanIntensityFromInputPins() {
   } else {
     intensity = INTENSITY_MEDIUM;
   }
+  if (intensityOverride != INTENSITY_UNDEF) {
+    intensity = intensityOverride;
+  }
   if (intensity != previous) {
-    #ifdef VERBOSE
-      Serial.print("Read Fan Intensity: ");
-      Serial.println(intensity == INTENSITY_LOW ? "LOW" : (intensity == INTENSITY_HIGH ? "HIGH" :"MEDIUM"));
-      Serial.flush();
-    #endif
-  
+    TRACE(TRACE_INTENSITY_READ, 0, intensity);
+    if (intensityChangedHandler != NULL) intensityChangedHandler();
+  }
+}
+
+// The pin-change ISRs update the same state => interrupts disabled
+void LogicalIOModel::overrideFanMode(FanMode value) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    modeOverride = value;
+    updateFanModeFromInputPins();
+  }
+}
+
+void LogicalIOModel::overrideFanIntensity(FanIntensity value) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    intensityOverride = value;
+    updateFanIntensityFromInputPins();
+  }
+}
+
+void LogicalIOModel::overrideDutyValue(pwm_duty_t value) {
+  if (value != dutyOverride) {
+    dutyOverride = value;
     if (intensityChangedHandler != NULL) intensityChangedHandler();
   }
 }
@@ -72,51 +101,114 @@ void LogicalIOModel::updateFanIntensityFromInputPins() {
 #if defined(__AVR_ATmega328P__)
   void LogicalIOModel::wdtWakeupLEDBlip() {
     digitalWrite(WDT_WAKEUP_OUT_PIN, HIGH);
-    delay(50);  // do not use Scheduler because this is part of the wakeup routine
+    _delay_ms(50);  // do not use Scheduler because this is part of the wakeup routine
     digitalWrite(WDT_WAKEUP_OUT_PIN, LOW);
   }
 
   // Interrupt service routine for Pin Change Interrupt Request 0 => MODE
   ISR (PCINT0_vect) {  
-    debounceSwitch();
+    cpuClockFull();   // debounceInputPins() delays are based on F_CPU
+    MEM_STATS_ISR_ENTER();
+    countWakeup(WAKEUP_PIN_CHANGE);
+    debounceInputPins();
+    ISR_STATS_ENTER(ISR_STATS_PCINT0);   // after the debounce, see isr_stats.h
     LOGICAL_IO.updateFanModeFromInputPins();
+    MEM_STATS_ISR_EXIT();
+    ISR_STATS_EXIT(ISR_STATS_PCINT0);
   }
 
   // Interrupt service routine for Pin Change Interrupt Request 2 => INTENSITY
   ISR (PCINT2_vect) {  
-    debounceSwitch();
+    cpuClockFull();   // debounceInputPins() delays are based on F_CPU
+    MEM_STATS_ISR_ENTER();
+    countWakeup(WAKEUP_PIN_CHANGE);
+    debounceInputPins();
+    ISR_STATS_ENTER(ISR_STATS_PCINT2);   // after the debounce, see isr_stats.h
     LOGICAL_IO.updateFanIntensityFromInputPins();
+    MEM_STATS_ISR_EXIT();
+    ISR_STATS_EXIT(ISR_STATS_PCINT2);
   }
 
 #elif defined(__AVR_ATtiny85__)
   // Interrupt service routine for Pin Change Interrupt Request 0 => MODE & INTENSITY
   ISR (PCINT0_vect) {  
-    debounceSwitch();
+    cpuClockFull();   // debounceInputPins() delays are based on F_CPU
+    MEM_STATS_ISR_ENTER();
+    countWakeup(WAKEUP_PIN_CHANGE);
+    debounceInputPins();
+    ISR_STATS_ENTER(ISR_STATS_PCINT0);   // after the debounce, see isr_stats.h
     LOGICAL_IO.updateFanModeFromInputPins();
     LOGICAL_IO.updateFanIntensityFromInputPins();
+    MEM_STATS_ISR_EXIT();
+    ISR_STATS_EXIT(ISR_STATS_PCINT0);
   }
 #endif
 
-pwm_duty_t mapToDutyValue(FanSpeed speed) {
+permille_t mapToAirflow(FanSpeed speed) {
   switch (speed) {
-    case SPEED_OFF:     return PWM_DUTY_MIN;
-    case SPEED_MIN:     return FAN_CONTINUOUS_LOW_DUTY_VALUE;
-    case SPEED_MEDIUM:  return FAN_CONTINUOUS_MEDIUM_DUTY_VALUE;
-    default:            return FAN_CONTINUOUS_HIGH_DUTY_VALUE; 
+    case SPEED_MIN:     return FAN_CONTINUOUS_LOW_AIRFLOW;
+    case SPEED_MEDIUM:  return FAN_CONTINUOUS_MEDIUM_AIRFLOW;
+    default:            return FAN_CONTINUOUS_HIGH_AIRFLOW; 
   }
 }
 
-void LogicalIOModel::fanSpeed(FanSpeed speed) {
-  this->speed = speed;
-  fanDutyCycleValue = mapToDutyValue(speed);
-  pwmDutyCycle(fanDutyCycleValue);
+pwm_duty_t mapToDutyValue(FanChannel channel, FanSpeed speed) {
+  if (speed == SPEED_OFF) {
+    return PWM_DUTY_MIN;
+  }
+  permille_t airflow = mapToAirflow(speed);
+  if (channel == FAN_B) {
+    airflow = (uint32_t) airflow * FAN_B_AIRFLOW_SHARE / 1000;
+  }
+  return dutyValueForAirflow(airflow);
+}
+
+void LogicalIOModel::fanSpeed(FanChannel channel, FanSpeed speed) {
+  speed = min(speed, cap);
+  TRACE(TRACE_FAN_SPEED, channel, speed);
+  this->speed[channel] = speed;
+  if (speed != SPEED_OFF && dutyOverride != PWM_DUTY_MIN) {
+    fanDutyCycleValue[channel] = dutyOverride;
+  } else {
+    fanDutyCycleValue[channel] = mapToDutyValue(channel, speed);
+  }
+  pwmDutyCycle(channel, fanDutyCycleValue[channel]);
+}
+
+void LogicalIOModel::fanDutyValue(FanChannel channel, pwm_duty_t value) {
+  if (cap != SPEED_FULL) {
+    value = min(value, mapToDutyValue(channel, cap));
+  }
+  if (value == PWM_DUTY_MIN) {
+    speed[channel] = SPEED_OFF;
+  } else if (value == PWM_DUTY_MAX) {
+    speed[channel] = SPEED_FULL;
+  } else {
+    speed[channel] = SPEED_MEDIUM;   // closest match for read-back
+  }
+  TRACE(TRACE_FAN_SPEED, channel, speed[channel]);
+  fanDutyCycleValue[channel] = value;
+  pwmDutyCycle(channel, value);
+}
+
+bool LogicalIOModel::isPwmActive(FanChannel channel) {
+  return ! (fanDutyCycleValue[channel] == PWM_DUTY_MIN     // fan off – no PWM required
+          || fanDutyCycleValue[channel] == PWM_DUTY_MAX);  // fan on at maximum – no PWM required)
 }
 
 bool LogicalIOModel::isPwmActive() {
-  return ! (fanDutyCycleValue == PWM_DUTY_MIN     // fan off – no PWM required
-          || fanDutyCycleValue == PWM_DUTY_MAX);  // fan on at maximum – no PWM required)
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    if (isPwmActive(channel)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void LogicalIOModel::statusLED(bool on) {
-  digitalWrite(STATUS_LED_OUT_PIN, on);
+  #ifdef STATUS_LED
+    digitalWrite(STATUS_LED_OUT_PIN, on);
+  #else
+    (void) on;    // the pin is SDA
+  #endif
 }
@@ -16,15 +16,33 @@
       void init();
       FanMode fanMode() { return mode; }
       FanIntensity fanIntensity() { return intensity; }
-      FanSpeed fanSpeed() { return speed; }
-      void fanSpeed(FanSpeed speed);
-      bool isPwmActive();
+      FanSpeed fanSpeed(FanChannel channel) { return speed[channel]; }
+      pwm_duty_t fanDutyValue(FanChannel channel) { return fanDutyCycleValue[channel]; }
+      pwm_duty_t fanDutyOverride() { return dutyOverride; }
+      // Raw duty value, bypasses the speed mapping (interval programs, see interval_program.h)
+      void fanDutyValue(FanChannel channel, pwm_duty_t value);
+      void fanSpeed(FanChannel channel, FanSpeed speed);
+      bool isPwmActive(FanChannel channel);
+      bool isPwmActive();   // any channel
       
       void statusLED(bool on);
       #if defined(__AVR_ATmega328P__)
-        void wdtWakeupLEDBlip(); // uses delay() ==> needs Timer0
+        void wdtWakeupLEDBlip(); // busy wait (Timer0 is off)
       #endif
 
+      // Take precedence over the switch positions (e.g. set from the console, see console.h); 
+      // MODE_UNDEF / INTENSITY_UNDEF --> follow the switches again. A change invokes the handler like a switch would.
+      void overrideFanMode(FanMode mode);
+      void overrideFanIntensity(FanIntensity intensity);
+      // Raw duty value of every running fan instead of the calibrated airflow; PWM_DUTY_MIN --> calibrated again.
+      // Invokes the intensity handler => applied by the state machine like an intensity change
+      void overrideDutyValue(pwm_duty_t value);
+      // Highest speed (time-of-day profile, see day_clock.h), also for raw duty values; the duty override is not
+      // capped. Takes effect with the next speed or duty value set.
+      void speedCap(FanSpeed cap) { this->cap = cap; }
+      FanMode fanModeOverride() { return modeOverride; }
+      FanIntensity fanIntensityOverride() { return intensityOverride; }
+
       // invoked only be interrupt service routine (ISR)
       void updateFanModeFromInputPins();
       void updateFanIntensityFromInputPins();
@@ -36,11 +54,13 @@
     protected:
       FanMode mode = MODE_UNDEF;
       FanIntensity intensity = INTENSITY_UNDEF;
-      FanSpeed speed = SPEED_OFF;
+      FanMode modeOverride = MODE_UNDEF;
+      FanIntensity intensityOverride = INTENSITY_UNDEF;
+      pwm_duty_t dutyOverride = PWM_DUTY_MIN;
+      FanSpeed cap = SPEED_FULL;
+      FanSpeed speed[FAN_CHANNELS];
       // the value that is actually set on the PWM output pin
-      pwm_duty_t fanDutyCycleValue = 0; 
-      void fanDutyCycle(pwm_duty_t value);
-      pwm_duty_t fanDutyCycle() { return fanDutyCycleValue; }
+      pwm_duty_t fanDutyCycleValue[FAN_CHANNELS]; 
   };
 
 // Singleton instance of the LogicalIOModel class:
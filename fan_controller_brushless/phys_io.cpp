@@ -1,26 +1,43 @@
 #include <Arduino.h>
 #include <avr/power.h>
 #include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include <scheduler.h>
 #include "phys_io.h"
+#include "trace.h"
+#include "telemetry.h"
 
 void configInputPins() {
   #if defined(__AVR_ATmega328P__)
     configInputWithPullup(MODE_SWITCH_IN_PIN_1);
     configInputWithPullup(MODE_SWITCH_IN_PIN_2);
 
-  #elif defined(__AVR_ATtiny85__)
-    configInputWithPullup(MODE_SWITCH_IN_PIN);
+  #elif defined(__AVR_ATtiny85__) && ! defined(I2C_SLAVE)
+    configInputWithPullup(MODE_SWITCH_IN_PIN);    // I2C_SLAVE: SCL
   #endif
 
   configInputWithPullup(INTENSITY_SWITCH_IN_PIN_1);
   configInputWithPullup(INTENSITY_SWITCH_IN_PIN_2);
+  #ifdef FAN_TACH
+    configInputWithPullup(FAN_TACH_IN_PIN);   // open-collector output of the fan
+  #endif
+}
+
+void debounceInputPins() {
+  _delay_ms(INPUT_DEBOUNCE_DURATION_MS);
 }
 
 void configOutputPins() {
   configOutput(FAN_PWM_OUT_PIN);
-  configOutput(STATUS_LED_OUT_PIN);
+  #ifdef DUAL_FAN
+    configOutput(FAN_B_PWM_OUT_PIN);
+  #endif
   #if defined(__AVR_ATmega328P__)
+    configOutput(STATUS_LED_OUT_PIN);
     configOutput(WDT_WAKEUP_OUT_PIN);
+  #elif ! defined(I2C_SLAVE)
+    configOutput(STATUS_LED_OUT_PIN);             // I2C_SLAVE: SDA
   #endif
 }
 
@@ -31,14 +48,22 @@ void configPinChangeInterrupts() {
   // Pin-change interrupts are triggered for each level-change; this cannot be configured
   #if defined(__AVR_ATmega328P__)
     PCICR |= _BV(PCIE0);                       // Enable pin-change interrupt 0 => MODE
-    PCMSK0 = _BV(PCINT0) | _BV(PCINT1);       // Configure pins PB0, PB1
+    #ifdef DUAL_FAN
+      PCMSK0 = _BV(PCINT0) | _BV(PCINT3);     // Configure pins PB0, PB3
+    #else
+      PCMSK0 = _BV(PCINT0) | _BV(PCINT1);     // Configure pins PB0, PB1
+    #endif
     
     PCICR |= _BV(PCIE2);                       // Enable pin-change interrupt 2 => INTENSITY
     PCMSK2 |= _BV(PCINT22) | _BV(PCINT23);     // Configure pins PD6, PD7
 
   #elif defined(__AVR_ATtiny85__)
     GIMSK|= _BV(PCIE);
-    PCMSK|= _BV(PCINT2) | _BV(PCINT3) | _BV(PCINT4);    // Configure PB0, PB3 and PB4 as pin-change interrupt source
+    #ifdef I2C_SLAVE
+      PCMSK|= _BV(PCINT3) | _BV(PCINT4);                // Configure PB3 and PB4 as pin-change interrupt source (PB2 = SCL)
+    #else
+      PCMSK|= _BV(PCINT2) | _BV(PCINT3) | _BV(PCINT4);  // Configure PB2, PB3 and PB4 as pin-change interrupt source
+    #endif
   #endif
 }
 
@@ -46,7 +71,7 @@ void configPWM_Timer1() {
   #if defined(__AVR_ATmega328P__)
     // Arduino default PWM frequency = 490 Hz
 
-    // Configure Timer_1 for PWM @ 25 kHz.
+    // Configure Timer_1 for PWM @ 25 kHz (30 Hz with FAN_PWM_LOW_FREQUENCY).
     // Source: https://www.arduined.eu/arduino-pwm-pc-fan-control/
     //
     // Undo the configuration done by the Arduino core library:
@@ -56,30 +81,32 @@ void configPWM_Timer1() {
     // Waveform Generator Mode (WGM):
     // -> See Table 15-5 of ATmega328P Datasheet
     // - 4 bits, distributed across TCCR1A and TCCR1B 
-    // - Set to mode #10: "PWM, phase correct, 9-bit, TOP = ICR1" 
-    //   | WGM13 | WGM12 | WGM11 | WGM10 |
-    //   |   1   |   0   |   1   |   0   |
+    // - Set to mode #8: "PWM, phase and frequency correct, TOP = ICR1" 
+    //   | WGM13 | WGM12 | WGM11 | WGM10 |
+    //   |   1   |   0   |   0   |   0   |
+    //   Unlike mode #10, the OCR1x are updated and TOV1 is set at BOTTOM => a new TOP (ICR1 is NOT double-buffered) and 
+    //   the new duty take effect in the same period when TOP is written right after BOTTOM (CPU clock scaling, see scalePWM1())
 
     // Compare Output Mode for chanlels A / B (COM)
     // !!! Channels A and B have NOTHING TO DO WITH CONTROL REGISTERS A and B !!!
     // -> See Table 15-4 of ATmega328P Datasheet (this table applies due to the WGM13 bit)
-    // - Set to "Clear OC1A/OC1B on compare match when up-counting."
+    // - Set to "Clear OC1A/OC1B on compare match when up-counting." per fan channel by pwmConnect(), 
+    //   disconnected (0) here => a channel without PWM keeps its digital pin state
     // | COM1A1 | COM1A0 | COM1B1 | COM1B0 | 
     // |   1    |   0    |    1   |   0    |
 
     // Prescaler / Clock Select (CS)
     // - 3 bits
-    // - Set to 1 (no prescaling)
+    // - Set to 1 (no prescaling) or to 256 with FAN_PWM_LOW_FREQUENCY (see TIMER1_CLOCK_SELECT)
     //   | CS12 | CS11 | CS10 | 
     //   |  0   |  0   |   1  |
+    //   |  1   |  0   |   0  |
     // (see TCCR1B)
   
     // Configure Timer/Counter1 Control Register A (TCCR1A) 
     // | COM1A1 | COM1A0 | COM1B1 | COM1B0 |  -  |  -  | WGM11 | WGM10 |
-    // |   1    |   0    |    1   |   0    |  0  |  0  |   1   |   0   |
-    TCCR1A = _BV(COM1A1)
-          | _BV(COM1B1)
-          | _BV(WGM11);
+    // |   0    |   0    |    0   |   0    |  0  |  0  |   0   |   0   |
+    TCCR1A = 0;
 
     // Configure Timer/Counter1 Control Register B (TCCR1B) 
     // - Input Capture Noise Canceler (ICNC)
@@ -87,7 +114,7 @@ void configPWM_Timer1() {
     // | ICNC1 |  ICES1 |  -  | WGM13 | WGM12 | CS12 | CS11 | CS10 | 
     // |   0   |    0   |  0  |   1   |   0   |  0   |  0   |   1  |
     TCCR1B = _BV(WGM13)  
-          | _BV(CS10); // prescale factor = 1
+          | TIMER1_CLOCK_SELECT;
 
 
     TCNT1 = 0;  // Reset timer
@@ -120,7 +147,7 @@ void configPWM_Timer1() {
     TCCR1 |= _BV(COM1A1);
   
     // Configure PWM frequency:
-    TCCR1 |= _BV(CS10);         // prescale factor = 1
+    TCCR1 |= TIMER1_CLOCK_SELECT;   // prescale factor = 1 (256 with FAN_PWM_LOW_FREQUENCY)
     OCR1C = TIMER1_COUNT_TO;    // Count 0,1,2..compare-match,0,1,2..compare-match, etc
   
     // Determines Duty Cycle: OCR1A / OCR1C e.g. value of 50 / 200 --> 25%,  value of 50 --> 0%
@@ -128,67 +155,347 @@ void configPWM_Timer1() {
   #endif
 }
 
-void pwmDutyCycle(pwm_duty_t value) {
+// Timer1 is configured once and keeps running; the fan channels connect to it while their duty cycle is partial
+bool pwmTimerRunning = false;
+// per channel: true while Timer1 drives the PWM pin, false while the pin is a plain digital output (0% or 100% duty)
+bool pwmTimerConnected[FAN_CHANNELS];
+pwm_duty_t pwmDutyValue[FAN_CHANNELS];
+uint8_t pwmClockShift = 0;   // Timer1 runs on the CPU clock divided by 2^pwmClockShift
+
+pin_t fanPwmPin(FanChannel channel) {
+  #ifdef DUAL_FAN
+    return channel == FAN_B ? FAN_B_PWM_OUT_PIN : FAN_PWM_OUT_PIN;
+  #else
+    return FAN_PWM_OUT_PIN;
+  #endif
+}
+
+// Output-compare value for the current clock scaling; a partial duty cycle never becomes 0%
+uint16_t scaledDutyCycle(pwm_duty_t value) {
+  uint16_t scaled = ((uint32_t) value) * (TIMER1_COUNT_TO >> pwmClockShift) / PWM_DUTY_MAX;
+  return scaled > 0 ? scaled : 1;
+}
+
+void outputCompare(FanChannel channel, uint16_t value) {
+  #if defined(__AVR_ATmega328P__)
+    // Timer1 is 16 bit
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      // 16-bit write via the shared TEMP register must not be interrupted
+      if (channel == FAN_B) {
+        OCR1A = value;  // PWM on port 9
+      } else {
+        OCR1B = value;  // PWM on port 10
+      }
+    }
+
+  #elif defined(__AVR_ATtiny85__)
+    // Timer1 is 8 bit
+    OCR1A = value;  // PWM on port PB1
+  #endif
+}
+
+// Starting Timer1 once only keeps the other channel's PWM period intact when a channel connects
+void pwmConnect(FanChannel channel) {
+  if (! pwmTimerRunning) {
+    configPWM_Timer1();
+    pwmTimerRunning = true;
+  }
+  #if defined(__AVR_ATmega328P__)
+    TCCR1A |= channel == FAN_B ? _BV(COM1A1) : _BV(COM1B1);
+  #elif defined(__AVR_ATtiny85__)
+    TCCR1 |= _BV(COM1A1);
+  #endif
+  pwmTimerConnected[channel] = true;
+}
+
+void pwmDutyCycle(FanChannel channel, pwm_duty_t value) {
+  #ifdef VERBOSE
+    static bool pwmStarted = false;
+    if (value != PWM_DUTY_MIN && ! pwmStarted) {
+      pwmStarted = true;
+      uint32_t sinceBoot = now();  // [ms] scheduler time
+      TRACE(TRACE_BOOT_TO_PWM, channel, sinceBoot > UINT16_MAX ? UINT16_MAX : sinceBoot);
+    }
+  #endif
+  pwmDutyValue[channel] = value;
   if (value == PWM_DUTY_MIN) 	{
-		digitalWrite(FAN_PWM_OUT_PIN, LOW);   // digitalWrite turns PWM off
+		digitalWrite(fanPwmPin(channel), LOW);   // digitalWrite turns PWM off
+    pwmTimerConnected[channel] = false;
 	}	else if (value == PWM_DUTY_MAX) 	{
-		digitalWrite(FAN_PWM_OUT_PIN, HIGH);  // digitalWrite turns PWM off
+		digitalWrite(fanPwmPin(channel), HIGH);  // digitalWrite turns PWM off
+    pwmTimerConnected[channel] = false;
 	} else {
-    configPWM_Timer1();
+    // Connect the pin only when switching from a digital-pin state to PWM. While PWM is running, only the 
+    // output-compare register is written: it is double-buffered in PWM mode and latched by the hardware at 
+    // TOP (ATmega328P) or at counter reset (ATtiny85), so the current period completes and no truncated pulse occurs.
+    if (! pwmTimerConnected[channel]) {
+      pwmConnect(channel);
+    }
+    uint16_t scaled = scaledDutyCycle(value);
+    TRACE(TRACE_DUTY, channel, scaled);
+    outputCompare(channel, scaled);
+  }
+}
+
+void pwmStretch(FanChannel channel, bool on) {
+  if (on) {
+    if (pwmTimerConnected[channel]) {
+      digitalWrite(fanPwmPin(channel), HIGH);  // digitalWrite turns PWM off
+      pwmTimerConnected[channel] = false;
+    }
+  } else {
+    pwmDutyCycle(channel, pwmDutyValue[channel]);
+  }
+}
 
+void scaleOutputCompares() {
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    if (pwmTimerConnected[channel]) {
+      outputCompare(channel, scaledDutyCycle(pwmDutyValue[channel]));
+    }
+  }
+}
+
+// TOP (ICR1 / OCR1C) is not double-buffered: a TOP below the counter value would let Timer1 run on to 0xFFFF / 0xFF 
+// => one PWM period of several ms. TOP is therefore written right after the counter has wrapped, busy waiting for at
+// most one PWM period with interrupts disabled.
+void scalePWM1(uint8_t clockShift) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pwmClockShift = clockShift;
     #if defined(__AVR_ATmega328P__)
-      // Timer1 is 16 bit
-      uint16_t scaled = (((uint32_t) value) * TIMER1_COUNT_TO /  PWM_DUTY_MAX);
-      #ifdef VERBOSE
-        Serial.print("  -> OCR1B: ");
-        Serial.println(scaled);
-        Serial.flush();
-      #endif
-      OCR1B = scaled;  // PWM on port 10
+      scaleOutputCompares();              // double-buffered => take effect at the next BOTTOM
+      TIFR1 = _BV(TOV1);
+      while (! (TIFR1 & _BV(TOV1))) { }   // mode 8: set at BOTTOM
+      ICR1 = TIMER1_COUNT_TO >> clockShift;
 
     #elif defined(__AVR_ATtiny85__)
-      // Timer1 is 8 bit
-      uint8_t scaled = (((uint16_t) value) * TIMER1_COUNT_TO /  PWM_DUTY_MAX);
-      OCR1A = scaled;  // PWM on port PB1
+      TIFR = _BV(TOV1);
+      while (! (TIFR & _BV(TOV1))) { }    // set when the counter wraps after matching OCR1C
+      OCR1C = TIMER1_COUNT_TO >> clockShift;
+      scaleOutputCompares();
     #endif
   }
 }
 
+//
+// TACH
+//
+#ifdef FAN_TACH
+  volatile uint16_t tachPulseCount = 0;
+
+  void tachCounting(bool on) {
+    EIMSK &= ~ _BV(INT0);
+    if (on) {
+      tachPulseCount = 0;
+      EICRA = (EICRA & ~ (_BV(ISC01) | _BV(ISC00))) | _BV(ISC01);   // falling edge; wakes the MCU from IDLE only
+      EIFR = _BV(INTF0);    // discard an edge from before the window
+      EIMSK |= _BV(INT0);
+    }
+  }
+
+  uint16_t tachPulses() {
+    uint16_t pulses;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      pulses = tachPulseCount;
+    }
+    return pulses;
+  }
+
+  // Counted as a WAKEUP_TIMER wake-up by the sleep residency
+  ISR (INT0_vect) {
+    tachPulseCount++;
+  }
+#endif
+
+//
+// CPU CLOCK SCALING
+//
+clock_div_t bootClockPrescaler;   // ATtiny85: the CKDIV8 fuse divides the 8 MHz oscillator down to F_CPU = 1 MHz
+volatile bool cpuClockScaled = false;
+
+void cpuClockSlow() {
+  if (CPU_CLOCK_SLOW_SHIFT == 0) {
+    return;   // no Timer1 TOP left to divide without losing too much duty resolution
+  }
+  scalePWM1(CPU_CLOCK_SLOW_SHIFT);  // first: waits for the end of the PWM period at the full clock
+  clock_prescale_set((clock_div_t) (bootClockPrescaler + CPU_CLOCK_SLOW_SHIFT));
+  cpuClockScaled = true;
+}
+
+void cpuClockFull() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (cpuClockScaled) {
+      clock_prescale_set(bootClockPrescaler);
+      scalePWM1(0);
+      cpuClockScaled = false;
+    }
+  }
+}
+
+CpuActivity cpuActivity = CPU_AWAKE;
+volatile bool wakeupPending = false;  // true from going to sleep until the first wake-up has been counted
+volatile SleepResidency residency;
+uint32_t residencyPhaseStart = 0;     // time the CPU entered its current activity
+
+void residencySleeping(CpuActivity activity, uint32_t time) {
+  residency.awake += time - residencyPhaseStart;
+  residencyPhaseStart = time;
+  cpuActivity = activity;
+  wakeupPending = true;
+}
+
+void residencyAwake(uint32_t time) {
+  if (cpuActivity == CPU_POWER_DOWN) {
+    residency.powerDown += time - residencyPhaseStart;
+  } else {
+    residency.idleSleep += time - residencyPhaseStart;
+  }
+  residencyPhaseStart = time;
+  // only the watchdog and pin changes can wake the MCU from POWER-DOWN
+  countWakeup(cpuActivity == CPU_POWER_DOWN ? WAKEUP_WDT : WAKEUP_TIMER);  // no-op if a pin-change ISR has counted this wake-up
+  cpuActivity = CPU_AWAKE;
+}
+
+void countWakeup(WakeupCause cause) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (wakeupPending) {
+      wakeupPending = false;
+      if (residency.wakeups[cause] < UINT16_MAX) {
+        residency.wakeups[cause]++;
+      }
+    }
+  }
+}
+
+SleepResidency getSleepResidency() {
+  SleepResidency copy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    copy = *((SleepResidency*) & residency);
+  }
+  return copy;
+}
+
+//
+// PERIPHERAL GATING
+//
+#if defined(__AVR_ATmega328P__)
+  // Power Reduction Register: modules that keep their clock during sleep
+  const uint8_t SLEEP_PRR_ALL = _BV(PRTWI) | _BV(PRTIM2) | _BV(PRTIM0) | _BV(PRSPI) | _BV(PRTIM1) | _BV(PRUSART0) | _BV(PRADC);
+  const uint8_t SLEEP_PRR_KEEP = _BV(PRTIM1)     // PWM
+    #ifdef ISR_STATS
+      | _BV(PRTIM2)                              // ISR timestamps
+    #endif
+    #if defined(VERBOSE) || defined(CONSOLE)
+      | _BV(PRUSART0)                            // USART would have to be re-initialised after being stopped by PRR
+    #endif
+    #ifdef I2C_SLAVE
+      | _BV(PRTWI)                               // address match wakes the MCU
+    #endif
+    ;
+  // Digital input buffers of the unused analog pins PC0..PC5 (PD6/PD7 = AIN0/AIN1 are the intensity inputs)
+  #ifdef I2C_SLAVE
+    const uint8_t SLEEP_DIDR0 = _BV(ADC3D) | _BV(ADC2D) | _BV(ADC1D) | _BV(ADC0D);   // PC4 = SDA, PC5 = SCL
+  #else
+    const uint8_t SLEEP_DIDR0 = _BV(ADC5D) | _BV(ADC4D) | _BV(ADC3D) | _BV(ADC2D) | _BV(ADC1D) | _BV(ADC0D);
+  #endif
+
+#elif defined(__AVR_ATtiny85__)
+  const uint8_t SLEEP_PRR_ALL = _BV(PRTIM1) | _BV(PRTIM0) | _BV(PRUSI) | _BV(PRADC);
+  #ifdef I2C_SLAVE
+    const uint8_t SLEEP_PRR_KEEP = _BV(PRTIM1) | _BV(PRUSI);   // PWM, start condition wakes the MCU
+    // PB0 = SDA needs its digital input buffer
+    const uint8_t SLEEP_DIDR0 = _BV(ADC0D) | _BV(AIN1D);
+  #else
+    const uint8_t SLEEP_PRR_KEEP = _BV(PRTIM1);   // PWM
+    // Digital input buffers of PB5 (RESET) and of the output-only pins PB0 (AIN0) and PB1 (AIN1); PB2..PB4 need theirs for pin-change interrupts
+    const uint8_t SLEEP_DIDR0 = _BV(ADC0D) | _BV(AIN1D) | _BV(AIN0D);
+  #endif
+#endif
+
+uint8_t awakePRR;
+uint8_t awakeACSR;
+uint8_t awakeDIDR0;
+
+void peripheralsOffForSleep() {
+  awakePRR = PRR;
+  awakeACSR = ACSR;
+  awakeDIDR0 = DIDR0;
+
+  uint8_t keep = SLEEP_PRR_KEEP;
+  if (! telemetryIdle()) {
+    keep |= _BV(PRTIM0);    // times the bits of the telemetry burst
+  }
+  PRR = awakePRR | (SLEEP_PRR_ALL & ~keep);
+  ACSR = awakeACSR & ~_BV(ACIE);  // interrupt must be disabled before the comparator is switched off
+  ACSR |= _BV(ACD);
+  DIDR0 = awakeDIDR0 | SLEEP_DIDR0;
+}
+
+void peripheralsOnAfterSleep() {
+  DIDR0 = awakeDIDR0;
+  ACSR = awakeACSR;
+  PRR = awakePRR;
+}
+
 void configLowPower() {
+  bootClockPrescaler = clock_prescale_get();
   #if defined(__AVR_ATmega328P__)
     ADCSRA &= ~(1 << ADEN); // Disable ADC
     power_adc_disable();
     power_spi_disable();
-    #ifndef VERBOSE
+    #if ! defined(VERBOSE) && ! defined(CONSOLE)
       power_usart0_disable();
     #endif
-    power_twi_disable();
+    #ifndef I2C_SLAVE
+      power_twi_disable();
+    #endif
     
-    // power_timer0_disable(); // cannot disable, required for millis() function
     // power_timer1_disable(); // cannot disable, required for PWM output on Pin 10
     power_timer2_disable(); 
 
   #elif defined(__AVR_ATtiny85__)
-    power_usi_disable(); 
+    #ifndef I2C_SLAVE
+      power_usi_disable(); 
+    #endif
     
     ADCSRA &= ~_BV(ADEN);   // Disable ADC --> saves 320 µA on ATtiny85
     ACSR   |=  _BV(ACD);
     power_adc_disable();
-    
-    cli();                  // Stop interrupts to ensure the BOD timed sequence executes as required
-    sleep_bod_disable();    // Brown-out disable
-    sei();
   #endif
+
+  // Brown-out detection stays on during sleep: BODS is cleared by the hardware 3 cycles after it has been set, so it
+  // would have to be set right before each SLEEP instruction. sleep_cpu() is executed by the WatchdogTimerBasedScheduler 
+  // library after stopTimersDuringSleep() has returned, out of reach of this sketch --> disable BOD by fuse (BODLEVEL).
+
+  // Timer0 (Arduino millis() / delay()) is not used: the scheduler runs on the watchdog and all busy waits use _delay_ms()
+  // (see configPhysicalIO() in phys_io.h)
+  // => turn it off so its 1 kHz overflow interrupt does not wake the MCU from IDLE sleep
+  #if defined(__AVR_ATmega328P__)
+    TIMSK0 &= ~ _BV(TOIE0);   // Disable overflow interrupt
+  #elif defined(__AVR_ATtiny85__)
+    TIMSK &= ~ _BV(TOIE0);    // Disable overflow interrupt
+  #endif
+  power_timer0_disable();
+}
+
+uint8_t resetFlags;
+
+uint8_t getResetFlags() {
+  return resetFlags;
 }
 
 void configPhysicalIO() {
+  resetFlags = MCUSR;
+  MCUSR = 0;
   configInputPins();
   configOutputPins();
 
   configPinChangeInterrupts();
   sei();
 
-  pwmDutyCycle(PWM_DUTY_MIN); // turn PWM off
+  for (FanChannel channel = 0; channel < FAN_CHANNELS; channel++) {
+    pwmDutyCycle(channel, PWM_DUTY_MIN); // turn PWM off
+  }
 
   configLowPower();
 }
\ No newline at end of file
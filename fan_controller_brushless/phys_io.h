@@ -7,21 +7,36 @@
   
   #if defined(__AVR_ATmega328P__)
     // #define VERBOSE
+    // #define ISR_STATS      // ISR duration statistics --> see isr_stats.h
+    // #define CONSOLE        // text command console on USART0 --> see console.h
   #endif
+  // #define MEM_STATS        // stack / SRAM high-water marks --> see mem_stats.h
+  // #define FAN_PWM_LOW_FREQUENCY   // 2- or 3-pin fan: the PWM switches the fan supply --> see ANALOG OUT
+  // #define DUAL_FAN         // ATmega328P only: second, independently controlled fan on OC1A --> see FAN CHANNELS
+  // #define LED_TELEMETRY    // status frames as soft UART on the status LED pin --> see telemetry.h
+  // #define INTERVAL_PROGRAM // mode INTERVAL runs a step program from the EEPROM --> see interval_program.h
+  // #define DAY_CLOCK        // time-of-day profiles: speed caps and pause scaling, e.g. quiet hours --> see day_clock.h
+  // #define I2C_SLAVE        // setpoints and read-back over I2C (ATtiny85: replaces the status LED and the mode switch) --> see i2c_slave.h
   
   //
   // PINS
   //
   #if defined(__AVR_ATmega328P__)
     const pin_t MODE_SWITCH_IN_PIN_1 = 8;         // PB0 - digital: PB0==HIGH               --> OFF (HIGH --> port configured as pull-up)
-    const pin_t MODE_SWITCH_IN_PIN_2 = 9;         // PB1 - digital: PB0==HIGH && PB1==LOW   --> CONTINUOUS
+    #ifdef DUAL_FAN
+      const pin_t MODE_SWITCH_IN_PIN_2 = 11;      // PB3 - digital: PB0==HIGH && PB3==LOW   --> CONTINUOUS (PB1 = OC1A drives fan B)
+    #else
+      const pin_t MODE_SWITCH_IN_PIN_2 = 9;       // PB1 - digital: PB0==HIGH && PB1==LOW   --> CONTINUOUS
+    #endif
                                                   // PB0 - digital: PB0==HIGH && PB1==HIGH  --> INTERVAL
     const pin_t INTENSITY_SWITCH_IN_PIN_1 = 6;    // PD6 - digital: PD6==LOW  && PD7==HIGH  --> LOW INTENSITY
     const pin_t INTENSITY_SWITCH_IN_PIN_2 = 7;    // PD7 - digital: PD6==HIGH && PD7==LOW   --> HIGH INTENSITY
                                                   //                PD6==HIGH && PD7==HIGH  --> MEDIUM INTENSITY
     const pin_t FAN_PWM_OUT_PIN = 10;             // PB2 - OC1B PWM signal !! DO NOT CHANGE PIN !! (PWM configuration is specific to Timer 1)
+    const pin_t FAN_B_PWM_OUT_PIN = 9;            // PB1 - OC1A PWM signal of fan B (DUAL_FAN only) !! DO NOT CHANGE PIN !!
     const pin_t STATUS_LED_OUT_PIN = 5;           // PD5 - digital out; is on when fan is off, blinks during transitioning 
     const pin_t WDT_WAKEUP_OUT_PIN = 12;          // PB4 - digital out; blinks briefly after watchdog-timer wakeup 
+    const pin_t FAN_TACH_IN_PIN = 2;              // PD2 - INT0 tach signal of a 3-pin fan (FAN_PWM_LOW_FREQUENCY only)
   
   #elif defined(__AVR_ATtiny85__)
     const pin_t MODE_SWITCH_IN_PIN = PB2;         // digital: LOW --> CONTINOUS, HIGH --> INTERVAL (HIGH --> port configured as pull-up)
@@ -31,36 +46,152 @@
     const pin_t FAN_PWM_OUT_PIN = PB1;            // PWM signal @ 25 kHz
     const pin_t STATUS_LED_OUT_PIN = PB0;         // digital out; blinks shortly in long intervals when fan is in interval mode
   #endif 
+  #if ! (defined(__AVR_ATtiny85__) && defined(I2C_SLAVE))
+    #define STATUS_LED    // ATtiny85 with I2C_SLAVE: STATUS_LED_OUT_PIN is SDA => no LED, no LED animation tasks
+  #endif
+
+  //
+  // FAN CHANNELS
+  //
+  // DUAL_FAN: fan A (FAN_PWM_OUT_PIN, e.g. exhaust) and fan B (FAN_B_PWM_OUT_PIN, e.g. intake) share Timer1, the 
+  // switches and the scheduler; each one runs its own state machine and interval phase (see fan_control.cpp).
+  //
+  typedef uint8_t FanChannel;
+  const FanChannel FAN_A = 0;
+  const FanChannel FAN_B = 1;
+  #ifdef DUAL_FAN
+    #if ! defined(__AVR_ATmega328P__)
+      #error("DUAL_FAN requires the ATmega328P: the ATtiny85 has no pin left for a second fan")
+    #endif
+    const uint8_t FAN_CHANNELS = 2;
+  #else
+    const uint8_t FAN_CHANNELS = 1;
+  #endif
+  const uint16_t FAN_B_AIRFLOW_SHARE = 1000;    // [‰] of the airflow of fan A at the same intensity; same fan type assumed
 
   //
   // ANALOG OUT (PWM / Timer1 scaling to 25 kHz)
   //
+  // 4-pin fans: the PWM drives the control input of the fan @ 25 kHz.
+  // 2- or 3-pin fans (FAN_PWM_LOW_FREQUENCY): the PWM switches the fan supply through the MOSFET @ 30 Hz. Every switching
+  // transition costs energy in the MOSFET => switching losses drop with the frequency, by a factor of 25 kHz / 30 Hz 
+  // (estimate; the conduction losses stay the same). The fan electronics lose power in every PWM period, so the tach 
+  // signal is only valid while the supply is held on => see TACH.
+  //
   #if defined(__AVR_ATmega328P__)
-    const uint16_t TIMER1_COUNT_TO = 320;    // count to this value (Timer 1 is 16 bit)
+    #ifdef FAN_PWM_LOW_FREQUENCY
+      // PWM frequency = 16 MHz / 256 / (2 x 1042) = 30 Hz (phase and frequency correct PWM counts up and down)
+      const uint8_t TIMER1_CLOCK_SELECT = _BV(CS12);     // prescale factor = 256
+      const uint16_t TIMER1_COUNT_TO = 1042;             // count to this value (Timer 1 is 16 bit)
+    #else
+      const uint8_t TIMER1_CLOCK_SELECT = _BV(CS10);     // prescale factor = 1
+      const uint16_t TIMER1_COUNT_TO = 320;              // count to this value (Timer 1 is 16 bit)
+    #endif
 
   #elif defined(__AVR_ATtiny85__)
     #if (F_CPU == 1000000UL)
-      // PWM frequency = 1 MHz / 1 / 40 = 25 kHz 
-      const uint8_t TIMER1_COUNT_TO = 40;    // count to this value
+      #ifdef FAN_PWM_LOW_FREQUENCY
+        // PWM frequency = 1 MHz / 256 / 130 = 30 Hz 
+        const uint8_t TIMER1_CLOCK_SELECT = _BV(CS13) | _BV(CS10);   // prescale factor = 256
+        const uint8_t TIMER1_COUNT_TO = 129;   // count to this value
+      #else
+        // PWM frequency = 1 MHz / 1 / 40 = 25 kHz 
+        const uint8_t TIMER1_CLOCK_SELECT = _BV(CS10);   // prescale factor = 1
+        const uint8_t TIMER1_COUNT_TO = 40;    // count to this value
+      #endif
     #else
       #error("F_CPU is undefined or its value is unexpected")
     #endif
   #endif
+
+  //
+  // TACH (ATmega328P with FAN_PWM_LOW_FREQUENCY only: the ATtiny85 has no pin left for the tach signal)
+  //
+  // Pulse stretching: the fan supply is held on periodically until the tach signal is valid (see TachWindowTask)
+  //
+  #if defined(__AVR_ATmega328P__) && defined(FAN_PWM_LOW_FREQUENCY)
+    #define FAN_TACH
+  #endif
+  const uint8_t TACH_PULSES_PER_REVOLUTION = 2;
   
+  // CPU clock scaling: while the MCU sleeps in IDLE with PWM active, the CPU clock and Timer1 TOP are both divided by 
+  // 2^CPU_CLOCK_SLOW_SHIFT => same PWM frequency, duty resolution TIMER1_COUNT_TO >> CPU_CLOCK_SLOW_SHIFT steps
+  const uint8_t PWM_MIN_RESOLUTION = 40;    // lowest acceptable Timer1 TOP while the clock is scaled down
+
+  constexpr uint8_t cpuClockShiftFor(uint16_t top) {
+    return top >= 2 * PWM_MIN_RESOLUTION ? 1 + cpuClockShiftFor(top / 2) : 0;
+  }
+  #ifdef FAN_PWM_LOW_FREQUENCY
+    // A new TOP has to wait for the end of the PWM period (see scalePWM1()): up to 33 ms with interrupts disabled
+    const uint8_t CPU_CLOCK_SLOW_SHIFT = 0;
+  #else
+    const uint8_t CPU_CLOCK_SLOW_SHIFT = cpuClockShiftFor(TIMER1_COUNT_TO);   // ATtiny85 @ 1 MHz: 0 => no scaling
+  #endif
+
+  // Switch debouncing: busy wait inside the pin-change ISRs --> must not depend on Timer0
+  const uint8_t INPUT_DEBOUNCE_DURATION_MS = 10;  // [ms]
+
   // FAN SPEED CONTROL:
-  const  pwm_duty_t FAN_LOW_THRESHOLD_DUTY_VALUE = 20;  // [mV] // below this DUTY_VALUE @ 13 Volts, the fan will not move
+  const  pwm_duty_t FAN_LOW_THRESHOLD_DUTY_VALUE = 20;  // below this DUTY_VALUE @ 13 Volts, the fan will not move; first point of FAN_CALIBRATION
 
-  // Continuous operation:
-  const pwm_duty_t FAN_CONTINUOUS_LOW_DUTY_VALUE = FAN_LOW_THRESHOLD_DUTY_VALUE;   // do not set lower than FAN_LOW_THRESHOLD_DUTY_VALUE --> fan would not start
-  const pwm_duty_t FAN_CONTINUOUS_MEDIUM_DUTY_VALUE = 35;
-  const pwm_duty_t FAN_CONTINUOUS_HIGH_DUTY_VALUE = PWM_DUTY_MAX;
+  // Continuous operation: airflow [‰ of the maximum]; mapped onto the lowest sufficient duty value with the fan 
+  // calibration table (see fan_calibration.h) => never below FAN_LOW_THRESHOLD_DUTY_VALUE
+  const uint16_t FAN_CONTINUOUS_LOW_AIRFLOW = 0;
+  const uint16_t FAN_CONTINUOUS_MEDIUM_AIRFLOW = 400;
+  const uint16_t FAN_CONTINUOUS_HIGH_AIRFLOW = 1000;
   
   // Interval operation:
   const pwm_duty_t INTERVAL_FAN_ON_DUTY_VALUE = PWM_DUTY_MAX;
   
+  //
+  // SLEEP RESIDENCY
+  //
+  typedef enum {CPU_AWAKE, CPU_IDLE_SLEEP, CPU_POWER_DOWN} CpuActivity;
+  // WAKEUP_WDT: watchdog wake-up from POWER-DOWN
+  // WAKEUP_TIMER: watchdog or timer wake-up from IDLE (the watchdog ISR belongs to the scheduler library => not distinguishable)
+  typedef enum {WAKEUP_WDT, WAKEUP_PIN_CHANGE, WAKEUP_TIMER, WAKEUP_CAUSES} WakeupCause;
+
+  // Durations are in scheduler time units (see D_1S)
+  typedef struct {
+    uint32_t awake;
+    uint32_t idleSleep;
+    uint32_t powerDown;
+    uint16_t wakeups[WAKEUP_CAUSES];
+  } SleepResidency;
+  
   //
   // CONFIGURATION
   //
+  // Powers Timer0 off (no 1 kHz wake-ups from IDLE sleep). Neither this sketch nor the WatchdogTimerBasedScheduler 
+  // library may use millis(), micros() or delay() --> busy waits use _delay_ms(), time is the scheduler's now().
+  // Check this when updating the scheduler library.
   void configPhysicalIO();
-  void pwmDutyCycle(pwm_duty_t value);
+  void pwmDutyCycle(FanChannel channel, pwm_duty_t value);
+  void debounceInputPins();
+  
+  // invoked by the scheduler right before going to sleep and right after waking up:
+  // Stops the clock of every module except Timer1 (PWM), turns off the analog comparator and the digital input buffers 
+  // of unused pins. Pin-change logic is not affected.
+  void peripheralsOffForSleep();
+  void peripheralsOnAfterSleep();
+  // Holds the fan supply on (PWM output HIGH) while stretched; the duty cycle is restored afterwards.
+  void pwmStretch(FanChannel channel, bool on);
+  // Counts falling edges on FAN_TACH_IN_PIN (INT0) while enabled; counting restarts from 0 when enabled
+  void tachCounting(bool on);
+  uint16_t tachPulses();
+  // Scales the CPU clock down for IDLE sleep (interrupts disabled) and back to F_CPU (ISR-safe). 
+  // Interrupt service routines that rely on F_CPU (delays, serial output) must call cpuClockFull() first.
+  void cpuClockSlow();
+  void cpuClockFull();
+  // time = scheduler now()
+  void residencySleeping(CpuActivity activity, uint32_t time);
+  void residencyAwake(uint32_t time);
+  // invoked by interrupt service routines (ISR) only
+  void countWakeup(WakeupCause cause);
+  
+  // Returns a consistent copy of the residency counters since boot
+  SleepResidency getSleepResidency();
+
+  // MCUSR as found at boot (cause of the last reset)
+  uint8_t getResetFlags();
 #endif
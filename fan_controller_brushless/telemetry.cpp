@@ -0,0 +1,139 @@
+#include <avr/power.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <scheduler.h>
+#include "telemetry.h"
+#include "log_io.h"
+#include "fan_control.h"
+
+#ifdef LED_TELEMETRY
+
+uint8_t telemetryFrame[TELEMETRY_FRAME_SIZE];
+volatile bool telemetryActive = false;   // from telemetrySend() until the last stop bit has ended
+volatile uint8_t telemetryIndex = 0;     // byte being sent
+volatile uint8_t telemetryBit = 0;       // 0: start bit, 1..8: data bits, 9: stop bit
+bool telemetryLedWasOn = false;
+
+inline uint8_t* telemetryPut(uint8_t* p, uint32_t value, uint8_t bytes) {
+  while (bytes-- > 0) {
+    *p++ = value;
+    value >>= 8;
+  }
+  return p;
+}
+
+// [‰] of the uptime
+uint16_t telemetryShare(uint32_t duration, uint32_t uptime) {
+  return uptime >= 1000 ? duration / (uptime / 1000) : 0;   // no 64-bit division
+}
+
+void telemetryCapture() {
+  LogicalIOModel* io = logicalIO();
+  SleepResidency r = getSleepResidency();
+  uint32_t uptime = r.awake + r.idleSleep + r.powerDown;
+
+  uint8_t faults = 0;
+  uint8_t resetFlags = getResetFlags();
+  if (resetFlags & _BV(BORF)) {
+    faults |= TELEMETRY_FAULT_BROWN_OUT;
+  }
+  if (resetFlags & _BV(WDRF)) {
+    faults |= TELEMETRY_FAULT_WATCHDOG;
+  }
+  #ifdef FAN_TACH
+    if (io->isPwmActive(FAN_A) && getFanRpm() == 0) {
+      faults |= TELEMETRY_FAULT_STALL;
+    }
+  #endif
+
+  uint8_t* p = telemetryFrame;
+  *p++ = 0xFF;
+  *p++ = TELEMETRY_SYNC;
+  *p++ = (io->fanMode() << 6) | (io->fanIntensity() << 4) | (io->fanSpeed(FAN_A) << 2) | getFanState(FAN_A);
+  *p++ = io->fanDutyValue(FAN_A);
+  *p++ = faults;
+  p = telemetryPut(p, uptime / D_1S, 4);
+  p = telemetryPut(p, telemetryShare(r.idleSleep, uptime), 2);
+  p = telemetryPut(p, telemetryShare(r.powerDown, uptime), 2);
+  for (uint8_t cause = 0; cause < WAKEUP_CAUSES; cause++) {
+    p = telemetryPut(p, r.wakeups[cause], 2);
+  }
+  uint8_t crc = 0;
+  for (uint8_t* q = telemetryFrame + 1; q < p; q++) {
+    crc = _crc8_ccitt_update(crc, *q);
+  }
+  *p = crc;
+}
+
+void telemetryTimer(bool on) {
+  if (on) {
+    power_timer0_enable();
+    TCCR0B = 0;
+    TCCR0A = _BV(WGM01);    // CTC, TOP = OCR0A; OC0A disconnected => the pin stays a plain digital output
+    TCNT0 = 0;
+    OCR0A = TELEMETRY_TIMER0_COUNT_TO;
+    #if defined(__AVR_ATmega328P__)
+      TIFR0 = _BV(OCF0A);
+      TIMSK0 |= _BV(OCIE0A);
+    #elif defined(__AVR_ATtiny85__)
+      TIFR = _BV(OCF0A);
+      TIMSK |= _BV(OCIE0A);
+    #endif
+    TCCR0B = TELEMETRY_TIMER0_CLOCK_SELECT;
+  } else {
+    TCCR0B = 0;
+    #if defined(__AVR_ATmega328P__)
+      TIMSK0 &= ~ _BV(OCIE0A);
+    #elif defined(__AVR_ATtiny85__)
+      TIMSK &= ~ _BV(OCIE0A);
+    #endif
+    power_timer0_disable();
+  }
+}
+
+void telemetrySend() {
+  if (! telemetryIdle()) {
+    return;
+  }
+  telemetryCapture();
+  telemetryLedWasOn = digitalRead(STATUS_LED_OUT_PIN);  // reads back the output latch
+  digitalWrite(STATUS_LED_OUT_PIN, HIGH);               // mark: at least one bit time before the first start bit
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    telemetryBit = 0;
+    telemetryIndex = 0;
+    telemetryActive = true;
+    telemetryTimer(true);
+  }
+}
+
+bool telemetryIdle() {
+  return ! telemetryActive;
+}
+
+// Counted as a WAKEUP_TIMER wake-up by the sleep residency
+ISR (TIMER0_COMPA_vect) {
+  if (telemetryIndex >= TELEMETRY_FRAME_SIZE) {
+    // the last stop bit has lasted a full bit time
+    telemetryTimer(false);
+    digitalWrite(STATUS_LED_OUT_PIN, telemetryLedWasOn);
+    telemetryActive = false;
+    return;
+  }
+  uint8_t bit = telemetryBit++;
+  if (bit == 0) {
+    digitalWrite(STATUS_LED_OUT_PIN, LOW);
+  } else if (bit <= 8) {
+    digitalWrite(STATUS_LED_OUT_PIN, (telemetryFrame[telemetryIndex] >> (bit - 1)) & 1);
+  } else {
+    digitalWrite(STATUS_LED_OUT_PIN, HIGH);
+    telemetryBit = 0;
+    telemetryIndex++;
+  }
+}
+
+#else
+
+void telemetrySend() { }
+bool telemetryIdle() { return true; }
+
+#endif
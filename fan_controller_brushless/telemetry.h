@@ -0,0 +1,58 @@
+#ifndef TELEMETRY_H_INCLUDED
+  #define TELEMETRY_H_INCLUDED
+
+  #include <Arduino.h>
+  #include <io_util.h>
+  #include "phys_io.h"
+
+  //
+  // Status frames on the status LED (#define LED_TELEMETRY --> see phys_io.h), e.g. for the ATtiny85, which has
+  // neither a spare pin nor a UART. Decode with tools/telemetry_decode.py
+  //
+  // STATUS_LED_OUT_PIN is driven as a transmit-only soft UART (8N1, LSB first, HIGH = LED on = mark). Timer0 (unused
+  // otherwise, see configLowPower()) times the bits in its compare-match ISR; the MCU sleeps in IDLE meanwhile.
+  // Receive with a USB-serial adapter on the pin (idle HIGH, TTL levels) or with a photodiode / phototransistor and a
+  // comparator in front of the LED. The LED is lit during the burst and restored to its state afterwards; a burst
+  // waits for the LED animations (see TelemetryTask).
+  //
+  // A frame is sent a moment after each handled event: state changes, a switch change (= request, the ATtiny85 has
+  // no other input left) and the boot.
+  //
+  // Frame: 0xFF (preamble), TELEMETRY_SYNC, then little endian:
+  //   state      (FanMode << 6) | (FanIntensity << 4) | (FanSpeed << 2) | FanState      (fan A)
+  //   duty       PWM duty value of fan A
+  //   faults     TELEMETRY_FAULT_... bits
+  //   uptime     uint32 [s]
+  //   idle       uint16 [‰] of the uptime in IDLE sleep
+  //   powerDown  uint16 [‰] of the uptime in POWER-DOWN sleep
+  //   wakeups    uint16 x 3: watchdog, pin change, timer (see WakeupCause)
+  //   crc        CRC-8 (polynomial 0x07, initial value 0) of the bytes from TELEMETRY_SYNC on
+  //
+  // Each bit wakes the MCU from IDLE => a burst adds TELEMETRY_FRAME_SIZE x 10 timer wake-ups to the residency.
+  //
+  const uint16_t TELEMETRY_BAUD_RATE = 1200;
+  const uint8_t TELEMETRY_SYNC = 0x5A;
+  const uint8_t TELEMETRY_FRAME_SIZE = 20;   // [bytes] incl. preamble and CRC
+  const uint16_t TELEMETRY_BURST_MS = (uint32_t) TELEMETRY_FRAME_SIZE * 10 * 1000 / TELEMETRY_BAUD_RATE + 1;  // [ms]
+
+  const uint8_t TELEMETRY_FAULT_BROWN_OUT = _BV(0);   // the last reset was caused by a brown-out
+  const uint8_t TELEMETRY_FAULT_WATCHDOG = _BV(1);    // the last reset was caused by the watchdog
+  const uint8_t TELEMETRY_FAULT_STALL = _BV(2);       // FAN_TACH: no tach pulse in the last window while fan A ran
+
+  // Timer0 in CTC mode: compare match once per bit
+  #if (F_CPU == 1000000UL)
+    const uint8_t TELEMETRY_TIMER0_CLOCK_SELECT = _BV(CS01);                // prescale factor = 8
+    const uint16_t TELEMETRY_TIMER0_PRESCALER = 8;
+  #else
+    const uint8_t TELEMETRY_TIMER0_CLOCK_SELECT = _BV(CS01) | _BV(CS00);    // prescale factor = 64
+    const uint16_t TELEMETRY_TIMER0_PRESCALER = 64;
+  #endif
+  const uint8_t TELEMETRY_TIMER0_COUNT_TO = F_CPU / TELEMETRY_TIMER0_PRESCALER / TELEMETRY_BAUD_RATE - 1;  // 1 MHz: 103, 16 MHz: 207
+
+  // Captures the fan state and starts a burst; no-op while a burst is running
+  void telemetrySend();
+
+  // Returns true if no burst is running (=> Timer0 may stop in sleep)
+  bool telemetryIdle();
+
+#endif
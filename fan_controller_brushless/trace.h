@@ -0,0 +1,59 @@
+#ifndef TRACE_H_INCLUDED
+  #define TRACE_H_INCLUDED
+
+  #include <Arduino.h> 
+  #include <io_util.h>
+  #include "phys_io.h"
+
+  //
+  // Binary trace of controller events (VERBOSE builds only).
+  //
+  // Records are written to a RAM ring buffer in a few cycles (also from ISRs) and are drained to the interrupt-driven 
+  // UART only right before the MCU goes to sleep. Decode the serial stream with tools/trace_decode.py --variant brushless
+  //
+  // Frame on the wire: TRACE_SYNC, time_ms (uint16 LE), id, state, value (uint16 LE)
+  //
+  
+  // !! Numeric values must match tools/trace_decode.py !!
+  typedef enum {
+    TRACE_NONE,
+    TRACE_BOOT,            // value: F_CPU / 1000 [kHz]
+    TRACE_MODE_READ,       // value: FanMode
+    TRACE_INTENSITY_READ,  // value: FanIntensity
+    TRACE_TRANSITION,      // state: (FanChannel << 4) | new FanState, value: (previous FanState << 8) | Event
+    TRACE_FAN_SPEED,       // state: FanChannel, value: FanSpeed
+    TRACE_DUTY,            // state: FanChannel, value: raw duty value written to the timer
+    TRACE_OVERFLOW,        // value: number of records dropped because the buffer was full
+    TRACE_ISR_COUNT,       // state: IsrStatsVector, value: number of measured executions
+    TRACE_ISR_MIN,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_MAX,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_AVG,         // state: IsrStatsVector, value: [Timer2 ticks]
+    TRACE_ISR_HISTOGRAM,   // state: (IsrStatsVector << 4) | bucket, value: count
+    TRACE_MEM_STATIC,      // value: .data + .bss + .noinit [bytes]
+    TRACE_MEM_FREE_STACK,  // value: minimum free stack since boot [bytes]
+    TRACE_MEM_ISR_NESTING, // value: worst ISR nesting depth
+    TRACE_FAN_RPM,         // value: fan speed measured in a tach window [RPM]
+    TRACE_PROGRAM,         // state: IntervalOpcode, value: (code offset << 8) | duty value before the instruction
+    TRACE_DAY_PROFILE,     // state: DAY_PROFILES index (0xFF: none), value: [min] since Monday 00:00
+    TRACE_BOOT_TO_PWM      // state: FanChannel, value: [ms] from boot to the first PWM output (once per boot)
+  } TraceId;
+  
+  const uint8_t TRACE_SYNC = 0xA5;
+  const uint8_t TRACE_BUFFER_SIZE = 32;  // [records] must be a power of 2
+
+  #ifdef VERBOSE
+    #define TRACE(id, state, value) traceRecord((id), (state), (value))
+  #else
+    #define TRACE(id, state, value)
+  #endif
+
+  // ISR-safe
+  void traceRecord(uint8_t id, uint8_t state, uint16_t value);
+  
+  // Writes as many buffered records to the UART as fit its transmit buffer without blocking
+  void traceDrain();
+
+  // Returns true if no records are buffered and the UART has finished transmitting (=> USART may stop in sleep)
+  bool traceIdle();
+
+#endif
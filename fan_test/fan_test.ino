@@ -10,6 +10,7 @@
 #if defined(__AVR_ATmega328P__)
   const pin_t FAN_PWM_OUT_PIN = 9;              // PIN 9 — OC1A PWM signal @ 25 kHz!! DO NOT CHANGE PIN !! (PWM configuration is specific to Timer 1)
   const pin_t STATUS_LED_OUT_PIN = 8; 
+  const pin_t FAN_TACH_IN_PIN = 2;              // PD2 - INT0: fan tachometer (open collector --> pull-up)
 
 #elif defined(__AVR_ATtiny85__)
   const pin_t FAN_PWM_OUT_PIN = PB1;            // OC1A PWM signal @ 25 kHz => MUST BE PB1!!!
@@ -30,7 +31,11 @@ void setup() {
   delay(2000);
 
   // test_steady_increments();
-  test_specific_duty_values();
+  #ifdef VERBOSE
+    characterise();   // CSV --> tools/fan_characterise.py
+  #else
+    test_specific_duty_values();
+  #endif
 
   turnOnLED(STATUS_LED_OUT_PIN, 2000);
   #ifdef VERBOSE
@@ -47,6 +52,7 @@ void testCycle(uint8_t blinkTimes, pwm_duty_t value) {
     flashLED(STATUS_LED_OUT_PIN, blinkTimes);
     #ifdef VERBOSE
       DEBUG("Duty value", value);
+      DEBUG("  -> OCR1A", timer1Value(value));
     #endif
     setFanDutyCycle(value);
     delay(10000);
@@ -83,6 +89,119 @@ void test_specific_duty_values() {
   #endif
 }
 
+// -------------
+// CHARACTERISATION (ATmega328P only: needs the serial port and the tachometer input)
+//
+// Sweeps the duty range up, each step starting from standstill (=> spin-up time and restart threshold), then down 
+// without stopping (=> stall threshold). Streams CSV: sweep,duty,ocr,rpm,spinup_ms; thresholds as "# key=value" lines.
+//
+#ifdef VERBOSE
+  const pwm_duty_t CHARACTERISE_STEP = 5;                  // [duty value] 
+  const uint16_t CHARACTERISE_SETTLE_MS = 5000;            // [ms] before the RPM is measured
+  const uint16_t CHARACTERISE_MEASURE_MS = 2000;           // [ms] tachometer pulses are counted this long
+  const uint16_t CHARACTERISE_SPINUP_TIMEOUT_MS = 5000;    // [ms] fan does not start at this duty value
+  const uint16_t CHARACTERISE_STOP_MS = 15000;             // [ms] max. time to coast to standstill
+  const uint8_t TACH_PULSES_PER_REVOLUTION = 2;            // most PC fans
+  
+  volatile uint16_t tachPulses = 0;
+  
+  void countTachPulse() {
+    tachPulses++;
+  }
+  
+  uint16_t tachPulsesSince(uint16_t start) {
+    noInterrupts();
+    uint16_t pulses = tachPulses;
+    interrupts();
+    return pulses - start;
+  }
+  
+  uint16_t measureRpm() {
+    uint16_t start = tachPulsesSince(0);
+    delay(CHARACTERISE_MEASURE_MS);
+    return (uint32_t) tachPulsesSince(start) * 60000UL / TACH_PULSES_PER_REVOLUTION / CHARACTERISE_MEASURE_MS;
+  }
+  
+  // Waits until no tachometer pulse has been seen for a measurement period
+  void stopFan() {
+    setFanDutyCycle(0);
+    unsigned long start = millis();
+    while (measureRpm() > 0 && millis() - start < CHARACTERISE_STOP_MS) { }
+  }
+  
+  // Returns [ms] until the fan has completed its first revolution; 0 if it has not started
+  uint16_t spinUp(pwm_duty_t value) {
+    uint16_t start = tachPulsesSince(0);
+    unsigned long startTime = millis();
+    setFanDutyCycle(value);
+    while (millis() - startTime < CHARACTERISE_SPINUP_TIMEOUT_MS) {
+      if (tachPulsesSince(start) >= TACH_PULSES_PER_REVOLUTION) {
+        return max(millis() - startTime, 1UL);
+      }
+    }
+    return 0;
+  }
+  
+  void printRow(const __FlashStringHelper* sweep, pwm_duty_t value, uint16_t rpm, uint16_t spinup_ms) {
+    Serial.print(sweep);
+    Serial.print(',');
+    Serial.print(value);
+    Serial.print(',');
+    Serial.print(timer1Value(value));
+    Serial.print(',');
+    Serial.print(rpm);
+    Serial.print(',');
+    Serial.println(spinup_ms);
+  }
+  
+  void printThreshold(const __FlashStringHelper* key, uint16_t value) {
+    Serial.print(F("# "));
+    Serial.print(key);
+    Serial.print('=');
+    Serial.println(value);
+  }
+  
+  void characterise() {
+    configInputWithPullup(FAN_TACH_IN_PIN);
+    attachInterrupt(digitalPinToInterrupt(FAN_TACH_IN_PIN), countTachPulse, FALLING);
+  
+    printThreshold(F("pwm_duty_max"), PWM_DUTY_MAX);
+    printThreshold(F("timer1_top"), TIMER1_COUNT_TO);
+    Serial.println(F("sweep,duty,ocr,rpm,spinup_ms"));
+  
+    pwm_duty_t restartDuty = 0;
+    for (uint16_t value = CHARACTERISE_STEP; ; value += CHARACTERISE_STEP) {
+      value = min(value, (uint16_t) PWM_DUTY_MAX);
+      stopFan();
+      uint16_t spinup_ms = spinUp(value);
+      delay(CHARACTERISE_SETTLE_MS);
+      printRow(F("up"), value, measureRpm(), spinup_ms);
+      if (restartDuty == 0 && spinup_ms > 0) {
+        restartDuty = value;
+      }
+      if (value == PWM_DUTY_MAX) {
+        break;
+      }
+    }
+  
+    pwm_duty_t stallDuty = 0;
+    for (int16_t value = PWM_DUTY_MAX; value > 0; value -= CHARACTERISE_STEP) {
+      setFanDutyCycle(value);
+      delay(CHARACTERISE_SETTLE_MS);
+      uint16_t rpm = measureRpm();
+      printRow(F("down"), value, rpm, 0);
+      if (rpm == 0) {
+        stallDuty = value;
+        break;
+      }
+    }
+    setFanDutyCycle(0);
+  
+    printThreshold(F("restart_duty"), restartDuty);
+    printThreshold(F("stall_duty"), stallDuty);
+  }
+#endif
+
 //
 // PWM / Timer1 scaling to 25 KHz
 //
@@ -184,19 +303,10 @@ void configPWM1() {
 }
 
 
-void setFanDutyCycle(pwm_duty_t value) {
-  #if defined(__AVR_ATmega328P__)
-    uint16_t scaled = (((uint32_t) value) * TIMER1_COUNT_TO /  PWM_DUTY_MAX);
-    #ifdef VERBOSE
-      DEBUG("  -> OCR1A", scaled);
-    #endif
-    OCR1A = scaled;
+uint16_t timer1Value(pwm_duty_t value) {
+  return ((uint32_t) value) * TIMER1_COUNT_TO /  PWM_DUTY_MAX;
+}
 
-  #elif defined(__AVR_ATtiny85__)
-    pwm_duty_t scaled = (((uint16_t) value) * TIMER1_COUNT_TO /  PWM_DUTY_MAX);
-    #ifdef VERBOSE
-      DEBUG("  -> OCR1A", scaled);
-    #endif
-    OCR1A = scaled;
-  #endif
+void setFanDutyCycle(pwm_duty_t value) {
+  OCR1A = timer1Value(value);   // ATmega328P: 16 bit, ATtiny85: 8 bit
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+Turns the CSV stream of fan_test.ino (characterise()) into the thresholds and the airflow tables the controllers compile
+in (fan_calibration.h: duty value -> airflow, fan_profile.h: voltage -> airflow, power).
+
+Usage:
+  fan_characterise.py /dev/ttyUSB0 --save silent_wings.csv        (requires pyserial; waits for the sweep to finish)
+  fan_characterise.py silent_wings.csv --supply-mv 13000 --max-power-mw 1800
+
+Input: "sweep,duty,ocr,rpm,spinup_ms" rows (sweep = up | down) and "# key=value" lines; anything else is ignored.
+
+Duty values are on the PWM_DUTY_MAX scale of fan_test. For the brushed controller, the effective fan voltage is
+taken as duty / PWM_DUTY_MAX x supply voltage. Airflow is taken as proportional to RPM. Power is not measured:
+it is estimated with the cube law from the RPM unless the table in fan_profile.h is corrected by hand.
+"""
+import argparse
+import sys
+
+MEDIUM_RPM_SHARE = 0.5   # continuous MEDIUM intensity: halfway between the RPM at the threshold and the maximum RPM
+
+
+def open_input(path, baud):
+    if path == '-':
+        return sys.stdin
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import io
+        import serial  # pyserial
+        return io.TextIOWrapper(serial.Serial(path, baud, timeout=None), encoding='ascii', errors='replace')
+    return open(path)
+
+
+def parse(lines, save=None):
+    rows = {'up': [], 'down': []}
+    keys = {}
+    for line in lines:
+        if save:
+            save.write(line)
+        line = line.strip()
+        if line.startswith('#') and '=' in line:
+            key, _, value = line[1:].partition('=')
+            keys[key.strip()] = int(value)
+            if key.strip() == 'stall_duty':
+                break  # last line of the sweep
+            continue
+        fields = line.split(',')
+        if len(fields) == 5 and fields[0] in rows:
+            try:
+                duty, ocr, rpm, spinup = (int(f) for f in fields[1:])
+            except ValueError:
+                continue
+            rows[fields[0]].append({'duty': duty, 'ocr': ocr, 'rpm': rpm, 'spinup_ms': spinup})
+    return rows, keys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='serial port, CSV file or - for stdin')
+    parser.add_argument('--baud', type=int, default=38400)
+    parser.add_argument('--save', type=argparse.FileType('w'), help='copy the raw stream to this file')
+    parser.add_argument('--supply-mv', type=int, default=13000, help='fan supply voltage of the brushed controller')
+    parser.add_argument('--max-power-mw', type=int, default=1800, help='fan power at full speed (cube-law estimate)')
+    parser.add_argument('--electronics-mw', type=int, default=100, help='fan power at standstill')
+    parser.add_argument('--profile-points', type=int, default=5, help='rows of the FAN_PROFILE table')
+    args = parser.parse_args()
+
+    rows, keys = parse(open_input(args.input, args.baud), args.save)
+    up = [r for r in rows['up'] if r['rpm'] > 0]
+    if not up:
+        sys.exit('no "up" rows with a running fan found')
+    duty_max = keys.get('pwm_duty_max', max(r['duty'] for r in rows['up']))
+    restart = keys.get('restart_duty') or min(r['duty'] for r in up)
+    stall = keys.get('stall_duty', 0)
+    rpm_max = max(r['rpm'] for r in up)
+    rpm_threshold = min(r['rpm'] for r in up if r['duty'] >= restart)
+    medium_airflow = round(1000 * (rpm_threshold + MEDIUM_RPM_SHARE * (rpm_max - rpm_threshold)) / rpm_max)
+
+    def millivolt(duty):
+        return round(args.supply_mv * duty / duty_max)
+
+    candidates = sorted((r for r in up if r['duty'] >= restart), key=lambda r: r['duty'])
+    n = max(2, min(args.profile_points, len(candidates)))
+    picks = [candidates[round(i * (len(candidates) - 1) / (n - 1))] for i in range(n)]
+    points = []  # (duty, airflow [‰], power [mW])
+    rpm = 0
+    for row in picks:
+        rpm = max(rpm, row['rpm'])  # the tables must be ascending => smooth out measurement noise
+        share = rpm / rpm_max
+        points.append((row['duty'], round(1000 * share), round(args.electronics_mw + args.max_power_mw * share ** 3)))
+
+    print('// fan characterisation: max. %d RPM, restarts from standstill at duty %d, stalls at duty %d'
+          % (rpm_max, restart, stall))
+    spinups = [r['spinup_ms'] for r in rows['up'] if r['spinup_ms'] > 0]
+    if spinups:
+        print('// spin-up from standstill: %d .. %d ms' % (min(spinups), max(spinups)))
+    print()
+    print('// fan_controller_brushless/phys_io.h')
+    print('const  pwm_duty_t FAN_LOW_THRESHOLD_DUTY_VALUE = %d;' % restart)
+    print('const uint16_t FAN_CONTINUOUS_MEDIUM_AIRFLOW = %d;' % medium_airflow)
+    print()
+    print('// fan_controller_brushless/fan_calibration.h')
+    print('const FanCalibrationPoint FAN_CALIBRATION[] PROGMEM = {')
+    print(',\n'.join('  { %3d, %4d }' % (duty, airflow) for duty, airflow, _ in points))
+    print('};')
+    print()
+    print('// fan_controller_brushed/fan_io.h, fan_control.h')
+    print('const millivolt_t FAN_LOW_THRESHOLD_VOLTAGE = %d;' % millivolt(restart))
+    print('const permille_t FAN_CONTINUOUS_MEDIUM_AIRFLOW = %d;' % medium_airflow)
+    print()
+    print('// fan_controller_brushed/fan_profile.h (power: cube-law estimate)')
+    print('const FanProfilePoint FAN_PROFILE[] PROGMEM = {')
+    print(',\n'.join('  { %5d, %4d, %4d }' % (millivolt(duty), airflow, power) for duty, airflow, power in points))
+    print('};')
+
+if __name__ == '__main__':
+    main()
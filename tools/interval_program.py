@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Assembles an interval program for the brushless controller with #define INTERVAL_PROGRAM (see interval_program.h)
+into an Intel HEX EEPROM image.
+
+Usage:
+  interval_program.py purge.txt -o purge.hex
+  avrdude -p m328p -c ... -U eeprom:w:purge.hex:i
+
+Source: one instruction per line, '#' starts a comment, 'name:' defines a label for LOOP and JUMP_INTENSITY.
+  DUTY <duty>                   duty value 0..255 (values below the stall threshold run at the threshold)
+  RAMP <duty> <seconds>         seconds 0..255
+  HOLD <seconds>                seconds 0..65535
+  LOOP <count> <label>          count 0 = forever
+  JUMP_INTENSITY <low> <medium> <high>
+  END
+
+Example (purge at full speed for 2 minutes, then cycle according to the intensity switch):
+          DUTY 255
+          HOLD 120
+  cycle:  JUMP_INTENSITY low medium high
+  low:    RAMP 60 10
+          HOLD 600
+          LOOP 0 cycle
+  ...
+"""
+import argparse
+import sys
+
+MAGIC = 0xB5                  # INTERVAL_PROGRAM_MAGIC
+ADDRESS = 0                   # INTERVAL_PROGRAM_ADDRESS
+MAX_LENGTH = 255
+
+# name: opcode, operand sizes [bytes]; operands of size 'a' are label addresses
+OPCODES = {
+    'END': (0, []),
+    'DUTY': (1, [1]),
+    'RAMP': (2, [1, 1]),
+    'HOLD': (3, [2]),
+    'LOOP': (4, [1, 'a']),
+    'JUMP_INTENSITY': (5, ['a', 'a', 'a']),
+}
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else crc << 1
+    return crc
+
+
+def parse(lines):
+    """Returns the instructions [(line number, mnemonic, operands)] and the labels {name: code offset}."""
+    instructions, labels, offset = [], {}, 0
+    for number, line in enumerate(lines, 1):
+        words = line.split('#', 1)[0].split()
+        while words and words[0].endswith(':'):
+            label = words.pop(0)[:-1]
+            if label in labels:
+                sys.exit('line %d: duplicate label %s' % (number, label))
+            labels[label] = offset
+        if not words:
+            continue
+        mnemonic = words[0].upper()
+        if mnemonic not in OPCODES:
+            sys.exit('line %d: unknown instruction %s' % (number, words[0]))
+        sizes = OPCODES[mnemonic][1]
+        if len(words) - 1 != len(sizes):
+            sys.exit('line %d: %s takes %d operand(s)' % (number, mnemonic, len(sizes)))
+        instructions.append((number, mnemonic, words[1:]))
+        offset += 1 + sum(1 if size == 'a' else size for size in sizes)
+    return instructions, labels
+
+
+def assemble(lines):
+    instructions, labels = parse(lines)
+    code = bytearray()
+    for number, mnemonic, operands in instructions:
+        opcode, sizes = OPCODES[mnemonic]
+        code.append(opcode)
+        for operand, size in zip(operands, sizes):
+            if size == 'a':
+                if operand not in labels:
+                    sys.exit('line %d: unknown label %s' % (number, operand))
+                code.append(labels[operand])
+                continue
+            try:
+                value = int(operand, 0)
+            except ValueError:
+                sys.exit('line %d: %s is not a number' % (number, operand))
+            if not 0 <= value < 1 << (8 * size):
+                sys.exit('line %d: %d out of range' % (number, value))
+            code += value.to_bytes(size, 'little')
+    if len(code) > MAX_LENGTH:
+        sys.exit('program too long: %d bytes (max %d)' % (len(code), MAX_LENGTH))
+    return bytes([MAGIC, len(code), crc8(code)]) + bytes(code)
+
+
+def intel_hex(data, address=ADDRESS):
+    records = []
+    for start in range(0, len(data), 16):
+        chunk = data[start:start + 16]
+        record = bytes([len(chunk), (address + start) >> 8, (address + start) & 0xFF, 0x00]) + chunk
+        records.append(':%s%02X' % (record.hex().upper(), -sum(record) & 0xFF))
+    records.append(':00000001FF')
+    return '\n'.join(records) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', type=argparse.FileType('r'))
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout, help='Intel HEX file')
+    args = parser.parse_args()
+
+    image = assemble(args.source.readlines())
+    args.output.write(intel_hex(image))
+    print('%d bytes of code, %d bytes of EEPROM' % (image[1], len(image)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""
+Reports the static SRAM usage (.data, .bss, .noinit) of a fan controller build per source module, so that memory
+regressions show up before flashing. Stack usage at runtime: see mem_stats.h (#define MEM_STATS).
+
+Usage:
+  ram_usage.py fan_controller_brushless.ino.elf
+  ram_usage.py --mcu attiny85 --max-static 400 build/fan_controller_brushed.ino.elf   (exit code 1 if exceeded)
+
+Requires avr-nm and avr-objdump (Arduino toolchain) on the PATH or --nm / --objdump; the ELF must contain debug info (Arduino builds do).
+Export the ELF with Arduino IDE "Sketch > Export compiled binary" or arduino-cli compile --output-dir.
+"""
+import argparse
+import collections
+import os
+import subprocess
+import sys
+
+SRAM_BYTES = {'atmega328p': 2048, 'attiny85': 512}
+COLUMNS = ['.data', '.bss', '.noinit']
+
+
+def sections(objdump, elf):
+    """Returns {section: (start, end)} of the SRAM sections."""
+    out = subprocess.run([objdump, '-h', elf], check=True, capture_output=True, text=True).stdout
+    ranges = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 4 and fields[1] in COLUMNS:
+            size, vma = int(fields[2], 16), int(fields[3], 16)
+            ranges[fields[1]] = (vma, vma + size)
+    return ranges
+
+
+def symbols(nm, objdump, elf):
+    """Yields (section, size, module, name) of every symbol in SRAM."""
+    ranges = sections(objdump, elf)
+    out = subprocess.run([nm, '--print-size', '--size-sort', '--line-numbers', elf],
+                         check=True, capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        symbol, _, location = line.partition('\t')
+        fields = symbol.split()
+        if len(fields) != 4:
+            continue
+        address, size, name = int(fields[0], 16), int(fields[1], 16), fields[3]
+        for section, (start, end) in ranges.items():
+            if start <= address < end:
+                module = os.path.basename(location.rsplit(':', 1)[0]) if location else '(unknown)'
+                yield section, size, module, name
+                break
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--nm', default='avr-nm')
+    parser.add_argument('--objdump', default='avr-objdump')
+    parser.add_argument('--mcu', choices=sorted(SRAM_BYTES), help='print the share of the SRAM size')
+    parser.add_argument('--max-static', type=int, help='fail if the static usage exceeds this [bytes]')
+    parser.add_argument('--symbols', action='store_true', help='list the symbols of each module')
+    parser.add_argument('elf')
+    args = parser.parse_args()
+
+    usage = collections.defaultdict(collections.Counter)
+    members = collections.defaultdict(list)
+    for section, size, module, name in symbols(args.nm, args.objdump, args.elf):
+        usage[module][section] += size
+        members[module].append((size, section, name))
+
+    print('%-24s %7s %7s %7s %7s' % ('module', *COLUMNS, 'total'))
+    total = collections.Counter()
+    for module in sorted(usage, key=lambda m: -sum(usage[m].values())):
+        total.update(usage[module])
+        print('%-24s %7d %7d %7d %7d' % (module, *(usage[module][c] for c in COLUMNS), sum(usage[module].values())))
+        if args.symbols:
+            for size, section, name in sorted(members[module], reverse=True):
+                print('    %-20s %-8s %5d' % (name, section, size))
+    static = sum(total.values())
+    print('%-24s %7d %7d %7d %7d' % ('TOTAL', *(total[c] for c in COLUMNS), static))
+    if args.mcu:
+        sram = SRAM_BYTES[args.mcu]
+        print('%d of %d bytes SRAM static (%.0f%%), %d bytes left for stack' % (static, sram, 100.0 * static / sram,
+                                                                                 sram - static))
+    if args.max_static is not None and static > args.max_static:
+        print('!! static SRAM usage %d exceeds %d bytes' % (static, args.max_static), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
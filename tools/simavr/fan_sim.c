@@ -0,0 +1,596 @@
+/*
+ * Runs a fan controller firmware under simavr, drives the mode and intensity switches from a scenario script and
+ * reports cycle-accurate metrics as one JSON object on stdout:
+ *   - PWM frequency and duty on FAN_PWM_OUT_PIN, the duty compared to the Timer1 registers (OCR / TOP)
+ *   - ISR durations [CPU cycles] per vector (from the vector jump to RETI, nested ISRs included)
+ *   - wake-ups per vector and the time spent in each sleep mode
+ * Optionally writes a VCD trace of the PWM pin, the status LED, the fan power pin (brushed), the sleep mode and the
+ * running ISR.
+ *
+ * Usage:
+ *   fan_sim -m atmega328p|attiny85 -f <F_CPU> [-d <boot CLKPR>] [-p <PWM Hz>] [-l <label>] [-v <trace.vcd>]
+ *           <firmware.elf> <scenario.scn>
+ *
+ *   -d  clock prescaler at reset (CKDIV8 fuse => 3): the oscillator runs at F_CPU << d
+ *   -p  expected PWM frequency [Hz]; default 25000
+ *
+ * Scenario: one command per line, '#' starts a comment; the switches are open (pull-ups) until set
+ *   mode off|continuous|interval   (the ATtiny85 has no OFF position => the scenario is reported as skipped)
+ *   intensity low|medium|high
+ *   run <ms>                       simulate
+ *   reset                          start the measurement window here (e.g. after the boot animation)
+ *
+ * Time is counted in seconds of the simulated oscillator: writes to CLKPR (CPU clock scaling during IDLE sleep)
+ * change the simulated CPU frequency, so cycle counts stay cycles of the scaled clock.
+ */
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_irq.h"
+#include "sim_interrupts.h"
+#include "avr_ioport.h"
+
+#define MAX_VECTORS 32
+#define MAX_NESTING 8
+#define NO_PIN 0
+
+typedef struct {
+  char port;      // 'B', 'D'; NO_PIN: not connected
+  uint8_t bit;
+} Pin;
+
+typedef enum {SLEEP_AWAKE, SLEEP_IDLE, SLEEP_POWER_DOWN, SLEEP_OTHER, SLEEP_STATES} SleepState;
+static const char* const SLEEP_NAMES[] = {"awake", "idle", "power_down", "other"};
+
+static const char* const VECTORS_ATMEGA328P[] = {
+  "RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT", "TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF",
+  "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA", "TIMER0_COMPB", "TIMER0_OVF",
+  "SPI_STC", "USART_RX", "USART_UDRE", "USART_TX", "ADC", "EE_READY", "ANALOG_COMP", "TWI", "SPM_READY"
+};
+static const char* const VECTORS_ATTINY85[] = {
+  "RESET", "INT0", "PCINT0", "TIMER1_COMPA", "TIMER1_OVF", "TIMER0_OVF", "EE_READY", "ANALOG_COMP", "ADC",
+  "TIMER1_COMPB", "TIMER0_COMPA", "TIMER0_COMPB", "WDT", "USI_START", "USI_OVF"
+};
+
+// Pins (see fan_io.h, phys_io.h) and registers of the supported MCUs
+typedef struct {
+  const char* name;             // simavr core
+  Pin pwm, led, power;
+  Pin mode1, mode2;             // mode1 == NO_PIN: no OFF position
+  Pin intensity1, intensity2;
+  uint16_t smcr;                // sleep mode register [data address]
+  uint8_t smShift, smMask;
+  uint16_t clkpr;
+  uint16_t ocr, top;            // Timer1 duty and TOP registers (low byte) [data address]
+  bool top16;
+  uint8_t topOffset;            // counts per period = TOP + topOffset
+  const char* const* vectors;
+  uint8_t vectorCount;
+} Mcu;
+
+static const Mcu MCUS[] = {
+  // Timer1 mode 8 (phase and frequency correct, TOP = ICR1), OC1B; SMCR SM2:0
+  {"atmega328p", {'B', 2}, {'D', 5}, {'D', 3}, {'B', 0}, {'B', 1}, {'D', 6}, {'D', 7},
+   0x53, 1, 0x07, 0x61, 0x8A, 0x86, true, 0,
+   VECTORS_ATMEGA328P, sizeof(VECTORS_ATMEGA328P) / sizeof(VECTORS_ATMEGA328P[0])},
+  // Timer1 PWM1A, TOP = OCR1C, OC1A; MCUCR SM1:0
+  {"attiny85", {'B', 1}, {'B', 0}, {'B', 5}, {NO_PIN, 0}, {'B', 2}, {'B', 4}, {'B', 3},
+   0x55, 3, 0x03, 0x46, 0x4E, 0x4D, false, 1,
+   VECTORS_ATTINY85, sizeof(VECTORS_ATTINY85) / sizeof(VECTORS_ATTINY85[0])},
+};
+
+static const Mcu* mcu;
+static avr_t* avr;
+
+//
+// TIME
+//
+static uint32_t oscillatorFrequency;          // [Hz] before the clock prescaler
+static double segmentTime = 0;                // [s] at segmentCycle
+static avr_cycle_count_t segmentCycle = 0;    // last change of the clock prescaler
+
+static double now_s(void) {
+  return segmentTime + (double) (avr->cycle - segmentCycle) / avr->frequency;
+}
+
+static void setClockPrescaler(uint8_t shift) {
+  segmentTime = now_s();
+  segmentCycle = avr->cycle;
+  avr->frequency = oscillatorFrequency >> shift;
+}
+
+static void clkprWrite(struct avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
+  if (! (v & 0x80)) {         // CLKPCE: the enable write itself does not change the clock
+    setClockPrescaler(v & 0x0F);
+  }
+  avr->data[addr] = v & 0x0F;
+}
+
+//
+// VCD
+//
+typedef enum {SIGNAL_PWM, SIGNAL_LED, SIGNAL_POWER, SIGNAL_SLEEP, SIGNAL_ISR, SIGNALS} Signal;
+static const char* const SIGNAL_NAMES[] = {"pwm", "led", "power", "sleep", "isr"};
+static const uint8_t SIGNAL_WIDTHS[] = {1, 1, 1, 2, 8};
+
+static FILE* vcd = NULL;
+static uint64_t vcdTime = UINT64_MAX;
+
+static void vcdOpen(const char* path) {
+  vcd = fopen(path, "w");
+  if (vcd == NULL) {
+    perror(path);
+    exit(2);
+  }
+  fprintf(vcd, "$timescale 1ns $end\n$scope module %s $end\n", mcu->name);
+  for (int s = 0; s < SIGNALS; s++) {
+    fprintf(vcd, "$var wire %d %c %s $end\n", SIGNAL_WIDTHS[s], '!' + s, SIGNAL_NAMES[s]);
+  }
+  fprintf(vcd, "$upscope $end\n$enddefinitions $end\n");
+}
+
+static void vcdChange(Signal signal, uint32_t value) {
+  if (vcd == NULL) {
+    return;
+  }
+  uint64_t time = (uint64_t) (now_s() * 1e9);
+  if (time != vcdTime) {
+    fprintf(vcd, "#%llu\n", (unsigned long long) time);
+    vcdTime = time;
+  }
+  if (SIGNAL_WIDTHS[signal] == 1) {
+    fprintf(vcd, "%u%c\n", value & 1, '!' + signal);
+  } else {
+    fputc('b', vcd);
+    for (int bit = SIGNAL_WIDTHS[signal] - 1; bit >= 0; bit--) {
+      fputc(value & (1 << bit) ? '1' : '0', vcd);
+    }
+    fprintf(vcd, " %c\n", '!' + signal);
+  }
+}
+
+//
+// METRICS (over the measurement window)
+//
+static double windowStart = 0;
+
+typedef struct {
+  uint32_t count;
+  avr_cycle_count_t min, max, total;
+} IsrStats;
+
+static IsrStats isrStats[MAX_VECTORS];
+static uint32_t wakeups[MAX_VECTORS];     // [0]: woken up without an ISR
+static double sleepTime[SLEEP_STATES];    // [s]
+
+typedef struct {
+  uint32_t periods;
+  double minHz, maxHz, sumHz;
+  uint32_t dutySamples;
+  double maxDutyError, sumDutyError;      // |measured - programmed| [%]
+} PwmStats;
+
+static PwmStats pwm;
+
+static void resetMetrics(void) {
+  windowStart = now_s();
+  memset(isrStats, 0, sizeof(isrStats));
+  memset(wakeups, 0, sizeof(wakeups));
+  memset(sleepTime, 0, sizeof(sleepTime));
+  memset(&pwm, 0, sizeof(pwm));
+}
+
+//
+// SLEEP AND ISRs
+//
+static SleepState sleepState = SLEEP_AWAKE;
+static double sleepStart;
+
+static SleepState sleepMode(void) {
+  switch ((avr->data[mcu->smcr] >> mcu->smShift) & mcu->smMask) {
+    case 0:  return SLEEP_IDLE;
+    case 2:  return SLEEP_POWER_DOWN;
+    default: return SLEEP_OTHER;
+  }
+}
+
+static void wakeUp(uint8_t vector) {
+  double start = sleepStart > windowStart ? sleepStart : windowStart;
+  sleepTime[sleepState] += now_s() - start;
+  wakeups[vector < MAX_VECTORS ? vector : 0]++;
+  sleepState = SLEEP_AWAKE;
+  vcdChange(SIGNAL_SLEEP, SLEEP_AWAKE);
+}
+
+static void trackSleep(void) {
+  if (avr->state == cpu_Sleeping && sleepState == SLEEP_AWAKE) {
+    sleepState = sleepMode();
+    sleepStart = now_s();
+    vcdChange(SIGNAL_SLEEP, sleepState);
+  } else if (avr->state != cpu_Sleeping && sleepState != SLEEP_AWAKE) {
+    wakeUp(0);
+  }
+}
+
+// Running vector: raised with the vector number on entry and with the interrupted vector (0: none) on RETI
+static struct {
+  uint8_t vector;
+  avr_cycle_count_t entry;
+} isrStack[MAX_NESTING];
+static uint8_t isrDepth = 0;
+
+static void isrExit(void) {
+  isrDepth--;
+  uint8_t vector = isrStack[isrDepth].vector;
+  if (vector >= MAX_VECTORS) {
+    return;
+  }
+  avr_cycle_count_t cycles = avr->cycle - isrStack[isrDepth].entry;
+  IsrStats* s = & isrStats[vector];
+  if (s->count == 0 || cycles < s->min) {
+    s->min = cycles;
+  }
+  if (cycles > s->max) {
+    s->max = cycles;
+  }
+  s->total += cycles;
+  s->count++;
+}
+
+static void isrRunning(struct avr_irq_t* irq, uint32_t value, void* param) {
+  if (isrDepth >= 2 && value == isrStack[isrDepth - 2].vector) {
+    isrExit();              // back to the interrupted ISR
+  } else if (value == 0) {
+    while (isrDepth > 0) {
+      isrExit();
+    }
+  } else if (isrDepth < MAX_NESTING) {
+    if (sleepState != SLEEP_AWAKE) {
+      wakeUp(value);
+    }
+    isrStack[isrDepth].vector = value;
+    isrStack[isrDepth].entry = avr->cycle;
+    isrDepth++;
+  }
+  vcdChange(SIGNAL_ISR, value);
+}
+
+//
+// PWM
+//
+static double expectedHz = 25000;
+static double lastRise = -1, lastFall = -1;     // [s]
+static double lastProgrammedDuty = -1;          // [%] at lastRise
+
+static double programmedDuty(void) {
+  uint32_t ocr = avr->data[mcu->ocr] | (mcu->top16 ? avr->data[mcu->ocr + 1] << 8 : 0);
+  uint32_t top = (avr->data[mcu->top] | (mcu->top16 ? avr->data[mcu->top + 1] << 8 : 0)) + mcu->topOffset;
+  return top == 0 ? 0 : 100.0 * (ocr < top ? ocr : top) / top;
+}
+
+static void pwmPin(struct avr_irq_t* irq, uint32_t value, void* param) {
+  double now = now_s();
+  vcdChange(SIGNAL_PWM, value);
+  if (! (value & 1)) {
+    lastFall = now;
+    return;
+  }
+  double duty = programmedDuty();
+  // a complete period within the window, the duty registers unchanged since its start
+  if (lastRise >= windowStart && lastFall > lastRise && now > lastRise) {
+    double hz = 1 / (now - lastRise);
+    if (pwm.periods == 0 || hz < pwm.minHz) {
+      pwm.minHz = hz;
+    }
+    if (hz > pwm.maxHz) {
+      pwm.maxHz = hz;
+    }
+    pwm.sumHz += hz;
+    pwm.periods++;
+    if (duty == lastProgrammedDuty) {
+      double error = fabs(100 * (lastFall - lastRise) / (now - lastRise) - duty);
+      if (error > pwm.maxDutyError) {
+        pwm.maxDutyError = error;
+      }
+      pwm.sumDutyError += error;
+      pwm.dutySamples++;
+    }
+  }
+  lastRise = now;
+  lastProgrammedDuty = duty;
+}
+
+static void ledPin(struct avr_irq_t* irq, uint32_t value, void* param) {
+  vcdChange(SIGNAL_LED, value);
+}
+
+static void powerPin(struct avr_irq_t* irq, uint32_t value, void* param) {
+  vcdChange(SIGNAL_POWER, value);
+}
+
+//
+// STIMULI
+//
+static avr_irq_t* pinIrq(Pin pin) {
+  return avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(pin.port), pin.bit);
+}
+
+// Switch contacts pull to GND, open contacts read HIGH (pull-ups)
+static void drive(Pin pin, int level) {
+  if (pin.port != NO_PIN) {
+    avr_raise_irq(pinIrq(pin), level);
+  }
+}
+
+static bool setMode(const char* value) {
+  if (strcmp(value, "off") == 0) {
+    if (mcu->mode1.port == NO_PIN) {
+      return false;
+    }
+    drive(mcu->mode1, 1);
+    drive(mcu->mode2, 1);
+  } else if (strcmp(value, "continuous") == 0) {
+    drive(mcu->mode1, 0);
+    drive(mcu->mode2, 1);
+  } else if (strcmp(value, "interval") == 0) {
+    drive(mcu->mode1, 0);
+    drive(mcu->mode2, 0);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool setIntensity(const char* value) {
+  if (strcmp(value, "low") == 0) {
+    drive(mcu->intensity1, 0);
+    drive(mcu->intensity2, 1);
+  } else if (strcmp(value, "medium") == 0) {
+    drive(mcu->intensity1, 1);
+    drive(mcu->intensity2, 1);
+  } else if (strcmp(value, "high") == 0) {
+    drive(mcu->intensity1, 1);
+    drive(mcu->intensity2, 0);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool runFor(double seconds) {
+  double end = now_s() + seconds;
+  while (now_s() < end) {
+    int state = avr_run(avr);
+    trackSleep();
+    if (state == cpu_Done || state == cpu_Crashed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// REPORT
+//
+static const char* label = "";
+static const char* scenarioName;
+
+static const char* vectorName(uint8_t vector, char* buffer) {
+  if (vector < mcu->vectorCount) {
+    return mcu->vectors[vector];
+  }
+  sprintf(buffer, "VECTOR_%u", vector);
+  return buffer;
+}
+
+static void reportHeader(void) {
+  printf("{\"firmware\": \"%s\", \"mcu\": \"%s\", \"scenario\": \"%s\"", label, mcu->name, scenarioName);
+}
+
+static void report(void) {
+  char buffer[16];
+  if (sleepState != SLEEP_AWAKE) {
+    double start = sleepStart > windowStart ? sleepStart : windowStart;
+    sleepTime[sleepState] += now_s() - start;
+    sleepStart = now_s();
+  }
+  double window = now_s() - windowStart;
+  double asleep = 0;
+  for (int s = SLEEP_IDLE; s < SLEEP_STATES; s++) {
+    asleep += sleepTime[s];
+  }
+  sleepTime[SLEEP_AWAKE] = window - asleep;
+
+  reportHeader();
+  printf(", \"window_s\": %.6f", window);
+
+  printf(", \"pwm\": {\"periods\": %u", pwm.periods);
+  if (pwm.periods > 0) {
+    double meanHz = pwm.sumHz / pwm.periods;
+    printf(", \"hz_mean\": %.1f, \"hz_min\": %.1f, \"hz_max\": %.1f, \"hz_error_pct\": %.3f",
+           meanHz, pwm.minHz, pwm.maxHz, 100 * (meanHz - expectedHz) / expectedHz);
+  }
+  if (pwm.dutySamples > 0) {
+    printf(", \"duty_error_mean_pct\": %.3f, \"duty_error_max_pct\": %.3f",
+           pwm.sumDutyError / pwm.dutySamples, pwm.maxDutyError);
+  }
+  printf(", \"duty_programmed_pct\": %.2f}", programmedDuty());
+
+  printf(", \"isr_cycles\": {");
+  const char* separator = "";
+  for (int v = 0; v < MAX_VECTORS; v++) {
+    IsrStats* s = & isrStats[v];
+    if (s->count > 0) {
+      printf("%s\"%s\": {\"count\": %u, \"min\": %llu, \"max\": %llu, \"avg\": %.1f}", separator,
+             vectorName(v, buffer), s->count, (unsigned long long) s->min, (unsigned long long) s->max,
+             (double) s->total / s->count);
+      separator = ", ";
+    }
+  }
+
+  printf("}, \"wakeups\": {");
+  separator = "";
+  for (int v = 0; v < MAX_VECTORS; v++) {
+    if (wakeups[v] > 0) {
+      printf("%s\"%s\": %u", separator, v == 0 ? "none" : vectorName(v, buffer), wakeups[v]);
+      separator = ", ";
+    }
+  }
+
+  printf("}, \"sleep_s\": {");
+  for (int s = 0; s < SLEEP_STATES; s++) {
+    printf("%s\"%s\": %.6f", s == 0 ? "" : ", ", SLEEP_NAMES[s], sleepTime[s]);
+  }
+  printf("}, \"sleep_residency_pct\": %.3f}\n", window > 0 ? 100 * asleep / window : 0);
+}
+
+static void reportSkipped(const char* reason) {
+  reportHeader();
+  printf(", \"skipped\": \"%s\"}\n", reason);
+}
+
+//
+// MAIN
+//
+static void usage(void) {
+  fprintf(stderr, "usage: fan_sim -m atmega328p|attiny85 -f <F_CPU> [-d <boot CLKPR>] [-p <PWM Hz>] [-l <label>] "
+                  "[-v <trace.vcd>] <firmware.elf> <scenario.scn>\n");
+  exit(2);
+}
+
+int main(int argc, char* argv[]) {
+  const char* mcuName = NULL;
+  const char* vcdPath = NULL;
+  uint32_t frequency = 0;
+  uint8_t bootPrescaler = 0;
+  int option;
+  while ((option = getopt(argc, argv, "m:f:d:p:l:v:")) != -1) {
+    switch (option) {
+      case 'm': mcuName = optarg; break;
+      case 'f': frequency = strtoul(optarg, NULL, 0); break;
+      case 'd': bootPrescaler = strtoul(optarg, NULL, 0); break;
+      case 'p': expectedHz = strtod(optarg, NULL); break;
+      case 'l': label = optarg; break;
+      case 'v': vcdPath = optarg; break;
+      default:  usage();
+    }
+  }
+  if (mcuName == NULL || frequency == 0 || argc - optind != 2) {
+    usage();
+  }
+  for (size_t i = 0; i < sizeof(MCUS) / sizeof(MCUS[0]); i++) {
+    if (strcmp(MCUS[i].name, mcuName) == 0) {
+      mcu = & MCUS[i];
+    }
+  }
+  if (mcu == NULL) {
+    usage();
+  }
+  const char* elfPath = argv[optind];
+  const char* scenarioPath = argv[optind + 1];
+  const char* base = strrchr(scenarioPath, '/');
+  scenarioName = strdup(base != NULL ? base + 1 : scenarioPath);
+  char* extension = strrchr((char*) scenarioName, '.');
+  if (extension != NULL) {
+    *extension = '\0';
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(elfPath, &firmware) != 0) {
+    fprintf(stderr, "%s: cannot read the firmware\n", elfPath);
+    return 2;
+  }
+  avr = avr_make_mcu_by_name(mcu->name);
+  if (avr == NULL) {
+    fprintf(stderr, "simavr does not support %s\n", mcu->name);
+    return 2;
+  }
+  avr_init(avr);
+  firmware.frequency = frequency;
+  avr_load_firmware(avr, &firmware);
+  oscillatorFrequency = frequency << bootPrescaler;
+  avr->frequency = frequency;
+  avr->data[mcu->clkpr] = bootPrescaler;
+  avr_register_io_write(avr, mcu->clkpr, clkprWrite, NULL);
+
+  if (vcdPath != NULL) {
+    vcdOpen(vcdPath);
+  }
+  avr_irq_register_notify(pinIrq(mcu->pwm), pwmPin, NULL);
+  avr_irq_register_notify(pinIrq(mcu->led), ledPin, NULL);
+  avr_irq_register_notify(pinIrq(mcu->power), powerPin, NULL);
+  avr_irq_register_notify(avr_get_interrupt_irq(avr, AVR_INT_ANY) + AVR_INT_IRQ_RUNNING, isrRunning, NULL);
+
+  // open switches
+  drive(mcu->mode1, 1);
+  drive(mcu->mode2, 1);
+  drive(mcu->intensity1, 1);
+  drive(mcu->intensity2, 1);
+  resetMetrics();
+
+  FILE* scenario = fopen(scenarioPath, "r");
+  if (scenario == NULL) {
+    perror(scenarioPath);
+    return 2;
+  }
+  char line[128];
+  int number = 0;
+  while (fgets(line, sizeof(line), scenario) != NULL) {
+    number++;
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char command[16], value[16];
+    int fields = sscanf(line, "%15s %15s", command, value);
+    if (fields <= 0) {
+      continue;
+    }
+    bool valid = fields == 2;
+    if (strcmp(command, "mode") == 0 && valid) {
+      if (! setMode(value)) {
+        if (strcmp(value, "off") == 0) {
+          reportSkipped("no OFF position on this MCU");
+          return 0;
+        }
+        valid = false;
+      }
+    } else if (strcmp(command, "intensity") == 0 && valid) {
+      valid = setIntensity(value);
+    } else if (strcmp(command, "run") == 0 && valid && isdigit((unsigned char) value[0])) {
+      if (! runFor(strtod(value, NULL) / 1000)) {
+        fprintf(stderr, "%s:%d: the firmware stopped (state %d) at %.6f s\n", scenarioPath, number, avr->state, now_s());
+        return 1;
+      }
+    } else if (strcmp(command, "reset") == 0 && fields == 1) {
+      valid = true;
+      resetMetrics();
+      if (sleepState != SLEEP_AWAKE) {
+        sleepStart = windowStart;
+      }
+    } else {
+      valid = false;
+    }
+    if (! valid) {
+      fprintf(stderr, "%s:%d: invalid command\n", scenarioPath, number);
+      return 2;
+    }
+  }
+  fclose(scenario);
+
+  report();
+  if (vcd != NULL) {
+    fclose(vcd);
+  }
+  return 0;
+}
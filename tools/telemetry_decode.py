@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""
+Decodes the status frames the brushless controller sends on its status LED with #define LED_TELEMETRY (see
+telemetry.h), e.g. from an ATtiny85 in the field.
+
+Usage:
+  telemetry_decode.py /dev/ttyUSB0             (requires pyserial; adapter RX on the LED pin or on a photodiode comparator)
+  telemetry_decode.py capture.bin
+
+Frame: 0xFF, 0x5A, state, duty, faults, uptime (uint32 LE), idle, power-down (uint16 LE, per mille),
+       wake-ups WDT, pin change, timer (uint16 LE), CRC-8 (poly 0x07) from 0x5A on
+"""
+import argparse
+import struct
+import sys
+import time
+
+from trace_decode import INTENSITIES, MODES, SPEEDS, VARIANTS, name, open_input
+
+TELEMETRY_SYNC = 0x5A
+FRAME = struct.Struct('<BBBIHHHHH')
+FAULTS = ['brown-out reset', 'watchdog reset', 'fan stalled']  # TELEMETRY_FAULT_... bits 0..2
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else crc << 1
+    return crc
+
+
+def describe(fields):
+    state, duty, faults, uptime, idle, power_down, wdt, pin, timer = fields
+    states = VARIANTS['brushless']['states']
+    flags = [f for bit, f in enumerate(FAULTS) if faults & (1 << bit)]
+    return ('State %s, %s %s, speed %s, duty %d | up %d s, idle %.1f %%, power-down %.1f %%, '
+            'wake-ups wdt %d pin %d timer %d%s') % (
+        name(states, state & 0x03), name(MODES, state >> 6), name(INTENSITIES, (state >> 4) & 0x03),
+        name(SPEEDS, (state >> 2) & 0x03), duty, uptime, idle / 10.0, power_down / 10.0, wdt, pin, timer,
+        ' | !! ' + ', '.join(flags) if flags else '')
+
+
+def frames(stream):
+    """Yields the fields of every frame with a valid CRC; resynchronises on TELEMETRY_SYNC after garbage."""
+    buf = b''
+    while True:
+        chunk = stream.read(max(1, stream.in_waiting) if hasattr(stream, 'in_waiting') else 64)
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(bytes([TELEMETRY_SYNC]))
+            if start < 0:
+                buf = b''
+                break
+            end = start + 1 + FRAME.size + 1
+            if len(buf) < end:
+                buf = buf[start:]
+                break
+            if crc8(buf[start:end - 1]) == buf[end - 1]:
+                yield FRAME.unpack_from(buf, start + 1)
+                buf = buf[end:]
+            else:
+                buf = buf[start + 1:]  # a data byte equal to the sync byte or a damaged frame
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--baud', type=int, default=1200)
+    parser.add_argument('input', help='serial port, capture file or - for stdin')
+    args = parser.parse_args()
+
+    for fields in frames(open_input(args.input, args.baud)):
+        print('%s  %s' % (time.strftime('%H:%M:%S'), describe(fields)), flush=True)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Decodes the binary trace stream written by the VERBOSE builds of the fan controllers (see trace.h).
+
+Usage:
+  trace_decode.py --variant brushed  /dev/ttyUSB0      (requires pyserial)
+  trace_decode.py --variant brushless capture.bin
+  cat /dev/ttyUSB0 | trace_decode.py --variant brushed -
+
+Frame: 0xA5, time_ms (uint16 LE), id (uint8), state (uint8), value (uint16 LE)
+"""
+import argparse
+import struct
+import sys
+
+TRACE_SYNC = 0xA5
+RECORD = struct.Struct('<HBBH')
+
+MODES = ['UNDEF', 'OFF', 'CONTINUOUS', 'INTERVAL']
+INTENSITIES = ['UNDEF', 'LOW', 'MEDIUM', 'HIGH']
+SPEEDS = ['OFF', 'MIN', 'MEDIUM', 'FULL']
+ISR_IDS = ['ISR_COUNT', 'ISR_MIN', 'ISR_MAX', 'ISR_AVG', 'ISR_HISTOGRAM']
+MEM_IDS = ['MEM_STATIC', 'MEM_FREE_STACK', 'MEM_ISR_NESTING']
+ISR_TICK_US = 2  # Timer2 at 16 MHz / 32, see isr_stats.h
+ISR_SATURATED = 0xFFFF  # ISR_STATS_SATURATED
+RESET_FLAGS = ['power-on', 'external', 'brown-out', 'watchdog']  # MCUSR bits 0..3
+PROGRAM_OPCODES = ['END', 'DUTY', 'RAMP', 'HOLD', 'LOOP', 'JUMP_INTENSITY']  # interval_program.h
+WEEKDAYS = ['Mon', 'Tue', 'Wed', 'Thu', 'Fri', 'Sat', 'Sun']  # day_clock.h
+
+# !! Must match the enums in fan_control.h and trace.h of the respective sketch !!
+VARIANTS = {
+    'brushed': {
+        'states': ['OFF', 'SPEEDING UP', 'STEADY', 'SLOWING DOWN', 'PAUSE'],
+        'events': ['NONE', 'Mode changed', 'Intensity changed', 'Speed reached', 'Phase ended'],
+        'ids': ['NONE', 'BOOT', 'MODE_READ', 'INTENSITY_READ', 'TRANSITION', 'SPEED_UP', 'SLOW_DOWN', 'DUTY',
+                'OVERFLOW'] + ISR_IDS + MEM_IDS + ['DWELL_HELD', 'CYCLE_SUPPRESSED'],
+        'vectors': ['PCINT0', 'INT0', 'WDT', 'handleStateTransition'],
+    },
+    'brushless': {
+        'states': ['OFF', 'ON', 'PAUSE', 'PROGRAM'],
+        'events': ['NONE', 'Mode changed', 'Intensity changed', 'Phase ended'],
+        'ids': ['NONE', 'BOOT', 'MODE_READ', 'INTENSITY_READ', 'TRANSITION', 'FAN_SPEED', 'DUTY', 'OVERFLOW'] + ISR_IDS
+               + MEM_IDS + ['FAN_RPM', 'PROGRAM', 'DAY_PROFILE', 'BOOT_TO_PWM'],
+        'vectors': ['PCINT0', 'PCINT2', 'handleStateTransition'],
+    },
+}
+
+
+def name(names, index):
+    return names[index] if 0 <= index < len(names) else '?(%d)' % index
+
+
+def fan(channel):
+    """Prefix for records of the second fan channel (brushless DUAL_FAN)"""
+    return 'Fan B: ' if channel else ''
+
+
+def describe(variant, rid, state, value):
+    v = VARIANTS[variant]
+    kind = name(v['ids'], rid)
+    if kind == 'BOOT':
+        flags = [f for bit, f in enumerate(RESET_FLAGS) if state & (1 << bit)]
+        return 'Boot, F_CPU = %d kHz%s' % (value, ', reset: ' + ' '.join(flags) if flags else '')
+    if kind == 'MODE_READ':
+        return 'Read Fan Mode: %s' % name(MODES, value)
+    if kind == 'INTENSITY_READ':
+        return 'Read Fan Intensity: %s' % name(INTENSITIES, value)
+    if kind == 'TRANSITION':
+        return '%sState %s -- [%s] --> State %s' % (fan(state >> 4),
+            name(v['states'], value >> 8), name(v['events'], value & 0xFF), name(v['states'], state & 0x0F))
+    if kind == 'SPEED_UP':
+        return 'Speeding up: %d' % value
+    if kind == 'SLOW_DOWN':
+        return 'Slowing down: %d' % value
+    if kind == 'FAN_SPEED':
+        return '%sFan speed: %s' % (fan(state), name(SPEEDS, value))
+    if kind == 'DUTY':
+        return '  -> %sduty register: %d' % (fan(state), value)
+    if kind == 'OVERFLOW':
+        return '!! %d trace records dropped (buffer full)' % value
+    if kind == 'ISR_COUNT':
+        return 'ISR %s: %d executions' % (name(v['vectors'], state), value)
+    if kind == 'ISR_MAX' and value == ISR_SATURATED:
+        return 'ISR %s: max too long to measure' % name(v['vectors'], state)
+    if kind in ('ISR_MIN', 'ISR_MAX', 'ISR_AVG'):
+        return 'ISR %s: %s %d us' % (name(v['vectors'], state), kind[4:].lower(), value * ISR_TICK_US)
+    if kind == 'ISR_HISTOGRAM':
+        bucket = state & 0x0F
+        low = 0 if bucket == 0 else (1 << (bucket - 1)) * ISR_TICK_US
+        high = (1 << bucket) * ISR_TICK_US
+        return 'ISR %s: %d x [%d us, %d us)' % (name(v['vectors'], state >> 4), value, low, high)
+    if kind == 'MEM_STATIC':
+        return 'SRAM: %d bytes static data' % value
+    if kind == 'MEM_FREE_STACK':
+        return 'SRAM: %d bytes never used by the stack' % value
+    if kind == 'MEM_ISR_NESTING':
+        return 'SRAM: worst ISR nesting depth %d' % value
+    if kind == 'FAN_RPM':
+        return 'Tach: %d RPM' % value
+    if kind == 'PROGRAM':
+        return 'Program @%d: %s (duty %d)' % (value >> 8, name(PROGRAM_OPCODES, state), value & 0xFF)
+    if kind == 'DAY_PROFILE':
+        profile = 'none' if state == 0xFF else 'entry %d' % state
+        return 'Day profile %s @ %s %02d:%02d' % (profile, WEEKDAYS[value // 1440 % 7], value // 60 % 24, value % 60)
+    if kind == 'BOOT_TO_PWM':
+        return '%sFirst PWM output %d ms after boot' % (fan(state), value)
+    if kind == 'DWELL_HELD':
+        return 'Held back: [%s] for %d s (minimum run / rest time)' % (name(v['events'], state), value)
+    if kind == 'CYCLE_SUPPRESSED':
+        return 'Start/stop cycle suppressed in State %s (%d since boot)' % (name(v['states'], state), value)
+    return '%s state=%d value=%d' % (kind, state, value)
+
+
+def frames(stream):
+    """Yields (time_ms, id, state, value); resynchronises on TRACE_SYNC after garbage."""
+    buf = b''
+    while True:
+        # serial ports: do not block for a full chunk so records show up as they arrive
+        chunk = stream.read(max(1, stream.in_waiting) if hasattr(stream, 'in_waiting') else 64)
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(bytes([TRACE_SYNC]))
+            if start < 0:
+                buf = b''
+                break
+            if len(buf) - start - 1 < RECORD.size:
+                buf = buf[start:]
+                break
+            yield RECORD.unpack_from(buf, start + 1)
+            buf = buf[start + 1 + RECORD.size:]
+
+
+def open_input(path, baud):
+    if path == '-':
+        return sys.stdin.buffer
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import serial  # pyserial
+        return serial.Serial(path, baud, timeout=None)
+    return open(path, 'rb')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--variant', choices=sorted(VARIANTS), required=True)
+    parser.add_argument('--baud', type=int, default=38400)
+    parser.add_argument('input', help='serial port, capture file or - for stdin')
+    args = parser.parse_args()
+
+    last = None
+    epoch_ms = 0
+    for time_ms, rid, state, value in frames(open_input(args.input, args.baud)):
+        if last is not None and time_ms < last:
+            epoch_ms += 0x10000  # 16-bit device timestamp wrapped
+        last = time_ms
+        print('%10.3f s  %s' % ((epoch_ms + time_ms) / 1000.0, describe(args.variant, rid, state, value)), flush=True)
+
+
+if __name__ == '__main__':
+    main()